@@ -4,11 +4,29 @@
  * but slightly adapted to compile using clang on Linux.
  *
  * compile:
- *  $ gcc -Wall -Werror -o ESAR ESAR.c
+ *  $ gcc -Wall -Werror -O2 -pthread -o ESAR ESAR.c -lm
  *
  * run:
  *  $ rtl_tcp -f 162e6 -s 300000 -a 127.0.0.1 -p 2345 -g 48.0
- *  $ ./ESAR
+ *  $ ./ESAR         (table)
+ *  $ ./ESAR -j      (JSON Lines, one object per decoded frame)
+ *  $ ./ESAR -n      (NMEA !AIVDM sentences)
+ *  $ ./ESAR -U aggregator:4000  (compact binary uplink, decoded by ./ESAR -X capture.bin)
+ *  $ ./ESAR -A 4000,4  (aggregator merging the -U or NMEA feeds of many stations, 4 threads)
+ *  $ ./ESAR -W 8080 (WebSocket feed of vessel updates on ws://host:8080/)
+ *  $ ./ESAR -H 8081 (HTTP: /vessels, /vessels?bbox=lon0,lat0,lon1,lat1, /track/<mmsi>, /geojson)
+ *  $ ./ESAR -T trace.json  (pipeline timeline for chrome://tracing)
+ *  $ ./ESAR -D fail.bin    (dump signal of frames failing sync/CRC)
+ *  $ ./ESAR -R fail.bin    (decode those dumps offline)
+ *  $ ./ESAR -w day.iq      (record IQ with a time index day.iq.idx)
+ *  $ ./ESAR -r day.iq -S 3600,3660   (decode one minute of the recording)
+ *  $ ./ESAR -Q 100,60    (position only after 100 m or 60 s, static data when changed)
+ *  $ ./ESAR -K 10        (only positions needed to rebuild each track within 10 m)
+ *  $ ./ESAR -r pass.iq -L 4000   (satellite downlink, Doppler up to 4 kHz)
+ *  $ ./ESAR -Y 2346      (two antennas, the second dongle on rtl_tcp -p 2346)
+ *  $ ./ESAR -E           (equalizer for a harbour antenna with strong reflections)
+ *  $ ./ESAR -F site.spec,10  (power spectra of the input and both channels every 10 s)
+ *  $ ./ESAR -B      (benchmark)
  */
 
 /*
@@ -32,10 +50,46 @@
 
 // Reference: Recommendation ITU-R M.1371-5 (02/2014)
 
+#define _USE_MATH_DEFINES  // M_PI on MSVC
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/select.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <netdb.h>
+    #include <fcntl.h>
+    #include <strings.h>
+    #include <unistd.h>
+    #include <poll.h>
+    #include <pthread.h>
+    #include <sys/resource.h>
+#elif defined(_WIN32)
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment (lib, "Ws2_32.lib")
+#endif
+
+#ifndef M_PI
+    #define M_PI 3.14159265358979323846  // not in ISO C
+#endif
+
+#if defined(_WIN32)
+    #define fseek64 _fseeki64
+#else
+    #define fseek64 fseeko
+#endif
 
 // =================================== AIS - decoder ===================================
 
@@ -53,292 +107,3922 @@ unsigned char* bits2chars(unsigned char *r, unsigned char *bitstream, int from,
     return r;
 }
 
+void int2bits(unsigned char *bitstream, int from, int n, int v)  // inverse of bits2int
+{
+    for(int i=from+n-1; i>=from; i--, v>>=1)
+        if (v&1) bitstream[i>>3] |= 1<<(7-(i&7));  else bitstream[i>>3] &= ~(1<<(7-(i&7)));
+}
+
+void chars2bits(unsigned char *bitstream, int from, int n, char *s)  // inverse of bits2chars, '@' padded
+{
+    for(int i=0; i<n/6; i++) { int c = *s ? *s++ : '@';  int2bits(bitstream, from + i*6, 6, c & 63); }
+}
+
 int sgn_lon(int x) { return (x&(1<<27)) ? (x-(1<<28)) : x; }  // extract sign -W +E
 int sgn_lat(int x) { return (x&(1<<26)) ? (x-(1<<27)) : x; }  // extract sign -S +N
 
-void parse_AIS_message(unsigned char *p)
+// ================================= String pool =====================================
+//
+// 6-bit text fields (call sign, name, destination) are interned by their raw payload bits: a repeated
+// static report costs a hash of a few bytes and returns the id of the text decoded the first time.
+
+#define SP_MAX  (1<<17)    // strings
+#define SP_HASH (2*SP_MAX)
+
+typedef struct
 {
-    int lat, lon;  // Geographical position
+    unsigned char key[17], nkey;  // payload bytes holding the field (edges masked), bit offset in key[16]
+    unsigned char s[21];          // as decoded by bits2chars
+} pool_str;
 
-    int mmid = bits2int(p, 0, 6);   printf(" %2d ", mmid);
-    int mmsi = bits2int(p, 8, 30);  printf(" %9d ", mmsi);
+pool_str sp[SP_MAX];  // id 0 = empty string
+int sp_n = 1;
+int sp_hash[SP_HASH];      // id, 0 = empty slot
+long long sp_hits, sp_misses, sp_full;  // sp_full: texts dropped to the empty string, pool full
 
-    switch (mmid)
+unsigned sp_slot(unsigned char *k, int n)
+{
+    unsigned h = 2166136261u;  // FNV-1a
+    for(int i=0; i<n; i++) h = (h ^ k[i]) * 16777619u;
+    return h & (SP_HASH-1);
+}
+
+char *str_of(int id) { return (char *)sp[id].s; }
+
+int str_intern(unsigned char *bitstream, int from, int n)  // id of the text in bits from..from+n
+{
+    unsigned char k[17];
+    int b0 = from>>3, nk = ((from+n-1)>>3) - b0 + 1;
+
+    memcpy(k, &bitstream[b0], nk);
+    k[0] &= 0xFF >> (from&7);
+    k[nk-1] &= 0xFF << (7 - ((from+n-1)&7));
+    k[nk++] = (from&7) | (n/6)<<3;
+
+    unsigned h = sp_slot(k, nk);
+    for(; sp_hash[h]; h = (h+1) & (SP_HASH-1))
+        if (sp[sp_hash[h]].nkey == nk && !memcmp(sp[sp_hash[h]].key, k, nk)) { sp_hits++;  return sp_hash[h]; }
+
+    if (sp_n == SP_MAX) { sp_full++;  return 0; }  // full until the next str_compact
+    sp_misses++;
+    pool_str *e = &sp[sp_n];
+    memcpy(e->key, k, nk);  e->nkey = nk;
+    bits2chars(e->s, bitstream, from, n);
+    return sp_hash[h] = sp_n++;
+}
+
+void str_compact(int *keep)  // keep[id] != 0 : still referred to, on return keep[id] = new id
+{
+    int n = 1;
+    keep[0] = 0;
+    for(int i=1; i<sp_n; i++)
+        if (keep[i]) { sp[n] = sp[i];  keep[i] = n++; }
+
+    sp_n = n;
+    memset(sp_hash, 0, sizeof(sp_hash));
+    for(int i=1; i<sp_n; i++)
     {
-        case 1: case 2: case 3:  lon = sgn_lon(bits2int(p, 61, 28));   // Shipborne mobile equipment
-                                 lat = sgn_lat(bits2int(p, 89, 27));
+        unsigned h = sp_slot(sp[i].key, sp[i].nkey);
+        while (sp_hash[h]) h = (h+1) & (SP_HASH-1);
+        sp_hash[h] = i;
+    }
+}
+
+// ================================= AIS messages =====================================
+
+typedef struct  // decoded AIS frame
+{
+    int id, mmsi, ch;  // message ID, MMSI, channel (1 = AIS 1 161.975 MHz, 2 = AIS 2 162.025 MHz)
+    double t;          // reception time, UTC seconds taken from the sample clock
+    int level, corr;   // quality: mean envelope over the frame, mean sync correlation per bit
+
+    int lon, lat;                                // 1/10000 min  (1,2,3,4)
+    int status, rot, sog, acc, cog, hdg, sec;    // 0.1 kn, 0.1 deg, deg  (1,2,3)
+    int year, month, day, hour, minute, second;  // base station UTC  (4)
+    int imo, type, bow, stern, port, starboard, eta_month, eta_day, eta_hour, eta_minute, draught;  // (5)
+    int csgn, name, dest;  // interned, str_of(id)                                                  (5)
+
+    unsigned char *p;  int len;  // CRC-verified payload and its length in bytes
+} AIS_msg;
+
+void parse_AIS_message(unsigned char *p, AIS_msg *m)
+{
+    m->id   = bits2int(p, 0, 6);
+    m->mmsi = bits2int(p, 8, 30);
 
-                                 printf(" %11.6lf %11.6lf ", (double)lon/600000, (double)lat/600000);
-                                 printf(" %3.0lf km/h   %5.1lf\n", 0.1852*bits2int(p, 50, 10), (double)bits2int(p, 116, 12)/10);
+    switch (m->id)
+    {
+        case 1: case 2: case 3:  m->status = bits2int(p, 38, 4);   // Shipborne mobile equipment
+                                 m->rot = (signed char)bits2int(p, 42, 8);
+                                 m->sog = bits2int(p, 50, 10);
+                                 m->acc = bits2int(p, 60, 1);
+                                 m->lon = sgn_lon(bits2int(p, 61, 28));
+                                 m->lat = sgn_lat(bits2int(p, 89, 27));
+                                 m->cog = bits2int(p, 116, 12);
+                                 m->hdg = bits2int(p, 128, 9);
+                                 m->sec = bits2int(p, 137, 6);
                                  break;
 
-        case 4: lon = sgn_lon(bits2int(p,  79, 28));   // Base station
-                lat = sgn_lat(bits2int(p, 107, 27));
+        case 4: m->year = bits2int(p, 38, 14);  m->month  = bits2int(p, 52, 4);  m->day    = bits2int(p, 56, 5);   // Base station
+                m->hour = bits2int(p, 61, 5);   m->minute = bits2int(p, 66, 6);  m->second = bits2int(p, 72, 6);
+                m->acc  = bits2int(p, 78, 1);
+                m->lon  = sgn_lon(bits2int(p,  79, 28));
+                m->lat  = sgn_lat(bits2int(p, 107, 27));
+                break;
+
+        case 5: m->imo = bits2int(p, 40, 30);   // Static and voyage related vessel data
+                m->csgn = str_intern(p, 70, 42);
+                m->name = str_intern(p, 112, 120);
+                m->type = bits2int(p, 232, 8);
+                m->bow  = bits2int(p, 240, 9);  m->stern = bits2int(p, 249, 9);
+                m->port = bits2int(p, 258, 6);  m->starboard = bits2int(p, 264, 6);
+                m->eta_month = bits2int(p, 274, 4);  m->eta_day    = bits2int(p, 278, 5);
+                m->eta_hour  = bits2int(p, 283, 5);  m->eta_minute = bits2int(p, 288, 6);
+                m->draught = bits2int(p, 294, 8);
+                m->dest = str_intern(p, 302, 120);
+                break;
+    }
+}
+
+int build_AIS_message(AIS_msg *m, unsigned char *p)  // inverse of parse_AIS_message for 1..5, returns payload bytes
+{
+    int len = m->id == 5 ? 53 : 21;
+    memset(p, 0, len);
+    int2bits(p, 0, 6, m->id);
+    int2bits(p, 8, 30, m->mmsi);
+
+    switch (m->id)
+    {
+        case 1: case 2: case 3:  int2bits(p, 38, 4, m->status);  int2bits(p, 42, 8, m->rot);  int2bits(p, 50, 10, m->sog);
+                                 int2bits(p, 60, 1, m->acc);  int2bits(p, 61, 28, m->lon);  int2bits(p, 89, 27, m->lat);
+                                 int2bits(p, 116, 12, m->cog);  int2bits(p, 128, 9, m->hdg);  int2bits(p, 137, 6, m->sec);
+                                 break;
 
-                printf(" %11.6lf %11.6lf ", (double)lon/600000, (double)lat/600000);
+        case 4: int2bits(p, 38, 14, m->year);  int2bits(p, 52, 4, m->month);  int2bits(p, 56, 5, m->day);
+                int2bits(p, 61, 5, m->hour);  int2bits(p, 66, 6, m->minute);  int2bits(p, 72, 6, m->second);
+                int2bits(p, 78, 1, m->acc);  int2bits(p, 79, 28, m->lon);  int2bits(p, 107, 27, m->lat);
+                break;
 
-                printf(" %d/%d/%d ", bits2int(p, 38, 14), bits2int(p, 52, 4), bits2int(p, 56, 5));  // date
-                printf(" %02d:%02d:%02d \n", bits2int(p, 61, 5), bits2int(p, 66, 6), bits2int(p, 72, 6));  // time
+        case 5: int2bits(p, 40, 30, m->imo);  chars2bits(p, 70, 42, str_of(m->csgn));  chars2bits(p, 112, 120, str_of(m->name));
+                int2bits(p, 232, 8, m->type);  int2bits(p, 240, 9, m->bow);  int2bits(p, 249, 9, m->stern);
+                int2bits(p, 258, 6, m->port);  int2bits(p, 264, 6, m->starboard);  int2bits(p, 274, 4, m->eta_month);
+                int2bits(p, 278, 5, m->eta_day);  int2bits(p, 283, 5, m->eta_hour);  int2bits(p, 288, 6, m->eta_minute);
+                int2bits(p, 294, 8, m->draught);  chars2bits(p, 302, 120, str_of(m->dest));
                 break;
+    }
+    return len;
+}
 
-        case 5: {
-                    unsigned char csgn[16], name[32], dest[32];  // Static and voyage related vessel data
+int out_json = 0;  // -j : one JSON object per decoded frame instead of the table
+int out_nmea = 0;  // -n : NMEA 0183 !AIVDM sentences
 
-                    printf(" %s << %s >> %s\n", bits2chars(csgn, p, 70, 42),
-                            bits2chars(name, p, 112, 120),
-                            bits2chars(dest, p, 302, 120));
-                    break;
-                }
+FILE *info_out(void) { return out_json || out_nmea ? stderr : stdout; }  // banners and statistics
+
+void print_table_header(void)
+{
+    if (info_out() == stdout) printf(" MID    MMSI      longitude   latitude     speed    course\n"
+                          "-------------------------------------------------------------\n");
+}
+
+void print_AIS_message(AIS_msg *m)
+{
+    printf(" %2d ", m->id);
+    printf(" %9d ", m->mmsi);
+
+    switch (m->id)
+    {
+        case 1: case 2: case 3:  printf(" %11.6lf %11.6lf ", (double)m->lon/600000, (double)m->lat/600000);
+                                 printf(" %3.0lf km/h   %5.1lf\n", 0.1852*m->sog, (double)m->cog/10);
+                                 break;
+
+        case 4: printf(" %11.6lf %11.6lf ", (double)m->lon/600000, (double)m->lat/600000);
+                printf(" %d/%d/%d ", m->year, m->month, m->day);  // date
+                printf(" %02d:%02d:%02d \n", m->hour, m->minute, m->second);  // time
+                break;
+
+        case 5: printf(" %s << %s >> %s\n", str_of(m->csgn), str_of(m->name), str_of(m->dest));  break;
 
         default: printf(" Unknown message ID\n");  break;
     }
 }
 
-unsigned short crc16(unsigned char *buff, int n)  // Frame Check Sequence, CRC-16-CCITT (0xFFFF)
+// ================================= Parse cache =====================================
+//
+// Static (5) and other non-position messages repeat with identical payloads.  Their parsed records are
+// kept in a direct-mapped cache indexed by the CRC and length, a hit is confirmed by comparing the
+// payload.  Position reports (1, 2, 3) change with every transmission and bypass it.
+
+#define PC_SIZE 1024
+
+typedef struct { int len;  unsigned char p[56];  AIS_msg m; } pc_entry;
+
+pc_entry pc[PC_SIZE];
+long long pc_hits, pc_misses;
+
+void pcache_clear(void) { for(int i=0; i<PC_SIZE; i++) pc[i].len = 0; }  // interned ids changed
+
+void parse_cached(unsigned char *p, int len, int crc, AIS_msg *m)
 {
-    unsigned short crc = 0xFFFF;
-    for(int i=0; i<n; i++)
-    { unsigned char data = buff[i];  data ^= crc & 0xff;  data ^= data << 4;
-        crc = ((data<<8) | (crc>>8)) ^ (data>>4) ^ (data<<3); }
-    return ~crc;
+    int id = p[0] >> 2;
+    if (id >= 1 && id <= 3) { parse_AIS_message(p, m);  return; }
+
+    pc_entry *e = &pc[(crc ^ len*40503) & (PC_SIZE-1)];
+    if (e->len == len && !memcmp(e->p, p, len)) { *m = e->m;  pc_hits++;  return; }
+
+    parse_AIS_message(p, m);  pc_misses++;
+    e->len = len;  memcpy(e->p, p, len);  e->m = *m;
 }
 
-#define PL 32  // HDLC synchronisation pattern legnth
+// ================================= Sample clock =====================================
+
+#define RATE 300000  // RTL sampling rate [IQ samples/s]
 
-int AIS_decode(int n, int rate, int *sA, int *sF, int i)
+double    clk_t0;   // UTC time of the first received IQ sample
+long long clk_smp;  // IQ samples received before the buffer being decoded
+double    clk_lag;  // [s] the decoder buffer starts this much before the IQ buffer (samples carried over, filter delay)
+
+double wall_time(void)
 {
-    int u, j, k=0;
+    struct timespec ts;  timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
 
-    // find 100 consecutive samples with amplitude >= 4
-    for(; i<n; i++) { if (sA[i] < 4*4) k=0;  else if (++k>=100) break; }
+double sample_time(int i, int rate) { return clk_t0 + (double)clk_smp/RATE - clk_lag + (double)i/rate; }  // sample i of the current buffer at given rate
 
-    i -= k;   if (i > n-500) return i;  // End of buffer
+// ================================= Timer wheel =====================================
+//
+// Hierarchical timer wheel on the sample clock: TW_LEVELS wheels of TW_SLOTS slots, level L slot
+// covering TW_SLOTS^L ticks.  Timers are intrusive list nodes, so insert, cancel and expire are O(1);
+// a far timer is moved down one level each time its slot comes round.
 
-    int pattern[PL] = {  1,1,0,0,1,1,0,0,  1,1,0,0,1,1,0,0,  1,1,0,0,1,1,0,0,  1,1,1,1,1,1,1,0  };  // NRZI
-    //  0 1 0 1 0 1 0 1   0 1 0 1 0 1 0 1   0 1 0 1 0 1 0 1   0 1 1 1 1 1 1 0  // preamble and 0x7E
+#define TW_TICK   0.1  // s
+#define TW_BITS   6
+#define TW_SLOTS  (1<<TW_BITS)
+#define TW_LEVELS 4
 
-    for(j=0; j<PL; j++) if (pattern[j]==0) pattern[j] =  1;
-    else pattern[j] = -1;
-    int smax=0, imax=0;
-    double T = ((double)rate) / 9600.0;  // GMSK - 9600 Bd
+typedef struct timer
+{
+    struct timer *next, *prev;   // NULL when not armed
+    long long when;              // tick
+    void (*fn)(struct timer *);
+} timer;
 
-    for(k=0; k<20*T; k++)  // find maximal correlation with pattern on interval <0,20*T> (i.e. synchronisation)
-    {
-        int s=0;
-        for(j=0; j<PL; j++) { int s0 = pattern[j] * sF[i+k+(int)(j*T+0.5)];   if (s0 < 0.0) break;   s+=s0; }
-        if (j==PL && s>smax) { smax=s; imax=k; }
-    }
+timer tw[TW_LEVELS][TW_SLOTS];  // list heads
+long long tw_now = -1;          // current tick, -1 before the first timer_run
+
+void tw_place(timer *t)
+{
+    long long d = t->when - tw_now;
+    int L = 0;
+    while (L < TW_LEVELS-1 && d >= (1LL << (TW_BITS*(L+1)))) L++;
+    if (d >= (1LL << (TW_BITS*TW_LEVELS))) t->when = tw_now + (1LL << (TW_BITS*TW_LEVELS)) - 1;  // beyond the wheel
+
+    timer *h = &tw[L][(t->when >> (TW_BITS*L)) & (TW_SLOTS-1)];
+    if (!h->next) h->next = h->prev = h;
+    t->next = h->next;  t->prev = h;  h->next->prev = t;  h->next = t;
+}
+
+void timer_cancel(timer *t)
+{
+    if (!t->next) return;
+    t->next->prev = t->prev;  t->prev->next = t->next;
+    t->next = t->prev = NULL;
+}
 
-    if (smax==0)
-        for(k=0; k<20*T; k++)  // try opposite polarisation
+void timer_set(timer *t, double when, void (*fn)(timer *))  // (re)arm to fire at sample clock time when
+{
+    timer_cancel(t);
+    if (tw_now < 0) tw_now = (long long)((clk_t0 ? clk_t0 + (double)clk_smp/RATE : when) / TW_TICK);  // the wheel starts now, not at the first timer
+    t->when = (long long)(when / TW_TICK);  t->fn = fn;
+    if (t->when <= tw_now) t->when = tw_now + 1;
+    tw_place(t);
+}
+
+void timer_moved(timer *t)  // the timer was copied to a new address
+{
+    if (t->next) { t->next->prev = t;  t->prev->next = t; }
+}
+
+void timer_run(double now)  // fire everything due up to now
+{
+    long long target = (long long)(now / TW_TICK);
+    if (tw_now < 0) tw_now = target;
+
+    while (tw_now < target)
+    {
+        tw_now++;
+        for(int L=1; L<TW_LEVELS && !(tw_now & ((1LL << (TW_BITS*L)) - 1)); L++)  // cascade the slot coming round
         {
-            int s=0;
-            for(j=0; j<PL; j++) { int s0 = pattern[j] * sF[i+k+(int)(j*T+0.5)];   if (s0 > 0.0) break;   s+=s0; }
-            if (j==PL && s<smax) { smax=s; imax=k; }
+            timer *h = &tw[L][(tw_now >> (TW_BITS*L)) & (TW_SLOTS-1)];
+            while (h->next && h->next != h) { timer *t = h->next;  timer_cancel(t);  tw_place(t); }
         }
 
-    if (smax==0) return i + 220*T;  // HDLC Synch not found
+        timer *h = &tw[0][tw_now & (TW_SLOTS-1)];
+        while (h->next && h->next != h) { timer *t = h->next;  timer_cancel(t);  t->fn(t); }
+    }
+}
 
-    i += imax;  // move to the beginning of AIS frame
+// ================================= Tracing =====================================
+//
+// -T file : every thread records the duration of the pipeline stages into its own buffer (no locks,
+// the only shared write is claiming a buffer), dumped at exit in Chrome trace-event format
+// (chrome://tracing, ui.perfetto.dev).
 
-    u = k = 0;
-    unsigned char msg[256];  msg[0] = 0;
-    unsigned char out, old_bit = 99, bit;
-    char o1,o2,o3,o4,o5;  o1=o2=o3=o4=o5=0;
+#define TRACE_THREADS 32
+#define TRACE_N       (1<<18)  // events per thread, further events are dropped
 
-    for(j=0; j<(n-i)/T; j++)  // HDLC decoding
-    {
-        if (sA[i+(int)(j*T+0.5)] < 2*2) break;  // weak signal
+typedef struct { const char *name;  double ts, dur; } trace_ev;
+typedef struct { trace_ev *ev;  atomic_int n; } trace_buf;
 
-        bit = (sF[i+(int)(j*T+0.5)] > 0) ? 0 : 1;
+char *trace_file;  // NULL = tracing off
+double trace_t0;
+trace_buf trace_bufs[TRACE_THREADS];
+atomic_int trace_nbufs;
+_Thread_local trace_buf *trace_my;
 
-        out = (bit != old_bit) ? 0 : 1;  // NRZI decoding (change=0, no change=1)
-        old_bit = bit;
+double trace_now(void) { return trace_file ? wall_time() : 0; }
 
-        // bit-stuffing: if 6 consecutive one's then zero is inserted because of flag 0x7E distinguishing => skip zero
-        if (o1==1 && o2==1 && o3==1 && o4==1 && o5==1) { o1=o2=o3=o4=o5=0;  if (out==0) continue; }
-        o5=o4; o4=o3; o3=o2; o2=o1; o1=out;
+double trace_mark(const char *name, double t0)  // record stage [t0, now], returns now
+{
+    if (!trace_file) return 0;
+    double t = wall_time();
 
-        if (out==1) msg[u] |= 1<<k;  // bits to byte (LSF)
+    if (!trace_my)
+    {
+        int k = atomic_fetch_add(&trace_nbufs, 1);
+        if (k >= TRACE_THREADS) return t;
+        trace_bufs[k].ev = malloc(TRACE_N * sizeof(trace_ev));
+        trace_my = &trace_bufs[k];
+    }
+    int n = atomic_load_explicit(&trace_my->n, memory_order_relaxed);
+    if (n < TRACE_N && trace_my->ev)
+    {
+        trace_ev *e = &trace_my->ev[n];
+        e->name = name;  e->ts = t0;  e->dur = t - t0;
+        atomic_store_explicit(&trace_my->n, n+1, memory_order_release);
+    }
+    return t;
+}
+
+void trace_dump(void)
+{
+    FILE *f = fopen(trace_file, "w");  if (!f) return;
+    int nb = atomic_load(&trace_nbufs), first = 1;
+    if (nb > TRACE_THREADS) nb = TRACE_THREADS;
 
-        if (++k == 8) { k=0;  u++;  msg[u]=0; }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for(int k=0; k<nb; k++)
+    {
+        int n = atomic_load_explicit(&trace_bufs[k].n, memory_order_acquire);
+        for(int i=0; i<n; i++)
+        {
+            trace_ev *e = &trace_bufs[k].ev[i];
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}", first ? "" : ",\n",
+                    e->name, k, (e->ts - trace_t0)*1e6, e->dur*1e6);
+            first = 0;
+        }
     }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+}
 
-    // CRC check :
+volatile sig_atomic_t trace_stop;  // Ctrl-C: the receive loops end, main returns and atexit dumps
 
-    int msgID = bits2int(&msg[4], 0, 6);
-    int msglen = (msgID == 5) ? 53 : 21;  // Message 5 is 424 bits long
+void trace_sigint(int sig) { trace_stop = 1;  signal(SIGINT, SIG_DFL); }  // a second Ctrl-C does not wait for the next block
 
-    int crc0 = *((unsigned short *)&msg[msglen+4]);
-    int crc  = crc16(&msg[4], msglen);
+void trace_open(char *file)
+{
+    trace_file = file;  trace_t0 = wall_time();
+    atexit(trace_dump);
+    signal(SIGINT, trace_sigint);
+}
 
-    if (crc == crc0) parse_AIS_message(&msg[4]);
+// ================================= JSON Lines output =====================================
 
-    return i + j*T;
+char *j_key(char *o, const char *k)
+{
+    if (o[-1] != '{') *o++ = ',';
+    *o++ = '"';  while (*k) *o++ = *k++;  *o++ = '"';  *o++ = ':';
+    return o;
 }
 
-// ================================= Tuning, Filtering, Demodulation =====================================
+char *j_num(char *o, long long v, int dec)  // fixed point number v / 10^dec
+{
+    char d[24];  int n = 0;
+    if (v < 0) { *o++ = '-';  v = -v; }
+    do { d[n++] = '0' + v%10;  v /= 10; } while (v || n <= dec);
+    while (n) { *o++ = d[--n];  if (n == dec && dec) *o++ = '.'; }
+    return o;
+}
 
-#define NIQ 300000  // 1 buf per second
+char *j_int(char *o, const char *k, long long v, int dec) { return j_num(j_key(o, k), v, dec); }
 
-#define FL 31  // FIR coeffs multiplied by factor 2^20
-int h3[FL] = { 349525, 288373, 143167, 0, -69570, -54470, 0, 36711, 30962, 0, -22642, -19513, 0, 14571, 12587, 0, -9335, -7997, 0, 5785, 4877, 0, -3395, -2804, 0, 1878, 1532, 0, -1044, -891, 0 };  // 1/3 band
-int h8[FL] = { 131072, 127428, 116895, 100620, 80332, 58108, 36092, 16222, 0, -11660, -18487, -20817, -19463, -15544, -10278, -4797, 0, 3534, 5569, 6171, 5631, 4356, 2772, 1239, 0, -830, -1251, -1339, -1205, -951, -648 };  // 1/8 band (6.25 kHz)
+char *j_str(char *o, const char *k, const char *s)
+{
+    int n = strlen(s);  while (n && (s[n-1] == '@' || s[n-1] == ' ')) n--;  // strip 6-bit padding
+    o = j_key(o, k);  *o++ = '"';
+    for(int i=0; i<n; i++) { if (s[i] == '"' || s[i] == '\\') *o++ = '\\';  *o++ = s[i]; }
+    *o++ = '"';
+    return o;
+}
 
-#if defined(__linux__) || defined(__APPLE__)
-    // https://clang.llvm.org/compatibility.html#inline
-    inline int fir_sample(int *x, int n, int h[]);
-    int fir_sample(int *x, int n, int h[])
+long long deg6(int x) { return ((long long)x*10 + (x < 0 ? -3 : 3)) / 6; }  // 1/10000 min -> 1e-6 deg
+
+char *json_format(char *o, AIS_msg *m)  // o must hold 512 bytes, returns end of the line
+{
+    *o++ = '{';
+    o = j_int(o, "t", (long long)(m->t*1000 + 0.5), 3);
+    o = j_str(o, "ch", m->ch == 1 ? "A" : "B");
+    o = j_int(o, "level", m->level, 0);
+    o = j_int(o, "corr", m->corr, 0);
+    o = j_int(o, "id", m->id, 0);
+    o = j_int(o, "mmsi", m->mmsi, 0);
+
+    switch (m->id)
     {
-        int s = h[0]*x[n-1];
-        for(int i=1; i<n; i++) s += h[i] * (x[n-i-1] + x[n+i-1]);
-        return s >> 19;
+        case 1: case 2: case 3:  o = j_int(o, "status", m->status, 0);
+                                 o = j_int(o, "rot", m->rot, 0);
+                                 o = j_int(o, "sog", m->sog, 1);
+                                 o = j_int(o, "acc", m->acc, 0);
+                                 o = j_int(o, "lon", deg6(m->lon), 6);
+                                 o = j_int(o, "lat", deg6(m->lat), 6);
+                                 o = j_int(o, "cog", m->cog, 1);
+                                 o = j_int(o, "hdg", m->hdg, 0);
+                                 o = j_int(o, "sec", m->sec, 0);
+                                 break;
+
+        case 4: o = j_int(o, "year", m->year, 0);  o = j_int(o, "month", m->month, 0);    o = j_int(o, "day", m->day, 0);
+                o = j_int(o, "hour", m->hour, 0);  o = j_int(o, "minute", m->minute, 0);  o = j_int(o, "second", m->second, 0);
+                o = j_int(o, "acc", m->acc, 0);
+                o = j_int(o, "lon", deg6(m->lon), 6);
+                o = j_int(o, "lat", deg6(m->lat), 6);
+                break;
+
+        case 5: o = j_int(o, "imo", m->imo, 0);
+                o = j_str(o, "callsign", str_of(m->csgn));
+                o = j_str(o, "name", str_of(m->name));
+                o = j_int(o, "type", m->type, 0);
+                o = j_int(o, "bow", m->bow, 0);    o = j_int(o, "stern", m->stern, 0);
+                o = j_int(o, "port", m->port, 0);  o = j_int(o, "starboard", m->starboard, 0);
+                o = j_int(o, "eta_month", m->eta_month, 0);  o = j_int(o, "eta_day", m->eta_day, 0);
+                o = j_int(o, "eta_hour", m->eta_hour, 0);    o = j_int(o, "eta_minute", m->eta_minute, 0);
+                o = j_int(o, "draught", m->draught, 1);
+                o = j_str(o, "destination", str_of(m->dest));
+                break;
     }
-#elif defined(_WIN32)
-    inline int fir_sample(int *x, int n, int h[])
+
+    *o++ = '}';  *o++ = '\n';
+    return o;
+}
+
+void json_AIS_message(AIS_msg *m)
+{
+    static char buf[512];
+    fwrite(buf, 1, json_format(buf, m) - buf, stdout);
+}
+
+// ================================= NMEA output =====================================
+
+char *nmea_format(char *o, unsigned char *p, int len, int ch, int seq)  // !AIVDM sentences of payload p, 60 characters each
+{
+    int nc = (len*8 + 5)/6, fill = nc*6 - len*8, parts = (nc + 59)/60;
+
+    for(int k=0; k<parts; k++)
     {
-        int s = h[0]*x[n-1];
-        for(int i=1; i<n; i++) s += h[i] * (x[n-i-1] + x[n+i-1]);
-        return s >> 19;
+        char *s = o;
+        o += parts > 1 ? sprintf(o, "!AIVDM,%d,%d,%d,%c,", parts, k+1, seq, ch == 1 ? 'A' : 'B')
+                       : sprintf(o, "!AIVDM,1,1,,%c,", ch == 1 ? 'A' : 'B');
+        for(int i=60*k; i<nc && i<60*(k+1); i++)
+        {
+            int v = i*6+6 <= len*8 ? bits2int(p, i*6, 6) : bits2int(p, i*6, len*8 - i*6) << fill;
+            *o++ = v < 40 ? v + 48 : v + 56;  // 6-bit armouring
+        }
+        o += sprintf(o, ",%d", k == parts-1 ? fill : 0);
+        int x = 0;  for(char *c = s+1; c < o; c++) x ^= *c;
+        o += sprintf(o, "*%02X\r\n", x);
     }
-#endif
+    return o;
+}
 
-void proces_buff(int n, unsigned char *buff)
+void nmea_AIS_message(AIS_msg *m)
 {
-    int i, rate = 300000;
-    static int I1[NIQ], Q1[NIQ], I2[NIQ/3], Q2[NIQ/3];
+    static char buf[256];
+    static int seq;  // of multi-sentence messages
+    if (m->len > 45) seq = (seq+1) % 10;
+    fwrite(buf, 1, nmea_format(buf, m->p, m->len, m->ch, seq) - buf, stdout);
+}
 
-    for(i=0; i<n; i++) { I1[i] = buff[2*i]   - 128;
-        Q1[i] = buff[2*i+1] - 128; }
+// ================================= Tracks =====================================
+//
+// Positions of all vessels go into one ring of TK_MAX points, each linked to the previous point of the
+// same vessel.  A track is read backwards from the vessel's last point until the ring has overwritten it.
+//
+// -K metres[,seconds] : simplify tracks by dead reckoning.  A position report is kept only when it is
+// more than metres off the position predicted from the last kept point with that point's speed and
+// course, or seconds passed since.  Kept points, dead reckoned until the next one, reproduce every
+// report within metres.  Reports not kept are neither stored nor output.
 
-    n /=3;  rate /= 3;  // originally intended for 100 kHz sampling rate, but RTL doesn't support it
+#define TK_MAX (1<<20)  // points, all vessels
 
-    for(i=0; i<n-10; i++) { I1[i] = fir_sample(&I1[3*i], FL, h3);  // third-sampling with anti-aliasing
-        Q1[i] = fir_sample(&Q1[3*i], FL, h3); }
+typedef struct { int mmsi, lon, lat;  short sog, cog;  unsigned prev;  double t; } tk_point;  // prev: the vessel's previous point
 
-    for(i=0; i<n; i+=4)  // split I/Q stream into AIS channels 1 & 2
-    {
-        I2[i+0] =  I1[i+0];  Q2[i+0] =  Q1[i+0];  // shift stream by 25 kHz (PI/2) to channel 2
-        I2[i+1] =  Q1[i+1];  Q2[i+1] = -I1[i+1];
-        I2[i+2] = -I1[i+2];  Q2[i+2] = -Q1[i+2];
-        I2[i+3] = -Q1[i+3];  Q2[i+3] =  I1[i+3];
+typedef struct
+{
+    unsigned last;  int len;                    // newest point, points linked
+    double at;  int alon, alat, asog, acog;     // last kept report, at = 0 : none yet
+} track;
 
-        I1[i+1] = -I2[i+1];  Q1[i+1] = -Q2[i+1];  // shift it back by 50 kHz (PI) to channel 1
-        I1[i+2] =  I2[i+2];  Q1[i+2] =  Q2[i+2];
-        I1[i+3] = -I2[i+3];  Q1[i+3] = -Q2[i+3];
-    }
+tk_point tk[TK_MAX];
+unsigned tk_n;  // points written, the next goes to tk[tk_n % TK_MAX]
 
-#define DCM 2  // works fine also with DCM 1, 3
+double tk_tol, tk_gap = 300;  // tk_tol 0 : off
+long long tk_kept, tk_skipped;
+
+void track_predict(track *k, double t, double *dx, double *dy)  // metres east and north the last kept report moves by t
+{
+    double v = k->asog < 1023 && k->acog < 3600 ? k->asog * (1852/36000.0) : 0, a = k->acog * (M_PI/1800);
+    *dx = v * sin(a) * (t - k->at);
+    *dy = v * cos(a) * (t - k->at);
+}
+
+int track_keep(track *k, double t, int lon, int lat, int sog, int cog)  // dead reckoning decision, kept reports become the reference
+{
+    if (k->at && t >= k->at && t - k->at < tk_gap)
+    {
+        double px, py;  track_predict(k, t, &px, &py);
+        double ex = (lon - k->alon) * cos(lat * (M_PI/180/600000)) * 0.1852 - px, ey = (lat - k->alat) * 0.1852 - py;
+        if (ex*ex + ey*ey <= tk_tol*tk_tol) { tk_skipped++;  return 0; }
+    }
+    k->at = t;  k->alon = lon;  k->alat = lat;  k->asog = sog;  k->acog = cog;
+    tk_kept++;
+    return 1;
+}
 
-    n /= DCM;   rate /= DCM;
+void track_add(track *k, int mmsi, double t, int lon, int lat, int sog, int cog)
+{
+    tk_point *p = &tk[tk_n % TK_MAX];
+    p->mmsi = mmsi;  p->lon = lon;  p->lat = lat;  p->sog = sog;  p->cog = cog;  p->t = t;  p->prev = k->last;
+    k->last = tk_n++;
+    if (k->len < TK_MAX) k->len++;
+}
 
-    for(i=0; i<n-15; i++) { I1[i] = fir_sample(&I1[DCM*i], FL, h8);  // half-sampling with low-pass 6.25 kHz
-        Q1[i] = fir_sample(&Q1[DCM*i], FL, h8);
-        I2[i] = fir_sample(&I2[DCM*i], FL, h8);
-        Q2[i] = fir_sample(&Q2[DCM*i], FL, h8); }
+int track_get(track *k, int mmsi, tk_point **p, int max)  // points still in the ring, newest first
+{
+    int n = 0;
+    for(unsigned a = k->last; n < k->len && n < max && tk_n - a <= TK_MAX && tk[a % TK_MAX].mmsi == mmsi; a = tk[a % TK_MAX].prev)
+        p[n++] = &tk[a % TK_MAX];
+    return n;
+}
 
-    for(i=0; i<n-1; i++) {  Q1[i] = Q1[i+1]*I1[i+0] - Q1[i+0]*I1[i+1];  // FM demodulation
-        Q2[i] = Q2[i+1]*I2[i+0] - Q2[i+0]*I2[i+1];
-        I1[i] = I1[i+1]*I1[i+1] + Q1[i+1]*Q1[i+1];  // AM demodulation
-        I2[i] = I2[i+1]*I2[i+1] + Q2[i+1]*Q2[i+1]; }
+// ================================= Vessel table =====================================
 
+#define VT_MAX  (1<<17)     // vessels tracked
+#define VT_HASH (2*VT_MAX)  // MMSI hash, open addressing
+#define VT_TTL  600         // s without a message before a vessel is dropped
 
-    i=0;   while (i<n-500) i = AIS_decode(n, rate, I1, Q1, i);  // Channel 1
-    i=0;   while (i<n-500) i = AIS_decode(n, rate, I2, Q2, i);  // Channel 2
+#define VF_POS    1   // lon, lat
+#define VF_SOG    2
+#define VF_COG    4
+#define VF_HDG    8
+#define VF_STATUS 16
+#define VF_STATIC 32  // content of message 5
+#define VF_ALL    63
 
-    fflush(stdout);
+typedef struct
+{
+    int mmsi, id;   // last message ID
+    double t;       // last update, sample clock
+    int lon, lat, sog, cog, hdg, status;
+    int imo, type, bow, stern, port, starboard, draught;
+    int csgn, name, dest;   // interned
+    unsigned h5;            // hash of the message 5 payload: ETA, EPFD, DTE and the rest not kept above
+    unsigned known, dirty;  // VF_ fields received so far / changed since the last tick
+    unsigned last;          // VF_ fields changed by the latest message
+    int kept;               // latest position report kept by the track simplifier
+    int out_lon, out_lat;   // last position output, see throttle_pass
+    double out_t;
+    int up_epoch, up_idx, up_lon, up_lat, up_sog, up_cog, up_hdg, up_status, up_rot;  // last sent by uplink_AIS_message
+    track trk;
+    timer expire;
+} vessel;
+
+vessel vt[VT_MAX];  int vt_n;        // dense array of vessels
+atomic_int vt_hash[VT_HASH];         // index+1 into vt, 0 = empty slot
+int vt_dirty[2*VT_MAX], vt_ndirty;   // MMSI of vessels changed or dropped since the last tick
+
+// The decoder thread is the only writer.  Other threads read through vessel_read / vessel_read_at:
+// every slot of vt has a sequence number, odd while the writer changes the slot, and a reader copies
+// the vessel between two equal even values.  vt_gen is odd while entries of vt_hash are shifted by a
+// removal, a lookup that found nothing during that time is repeated.  The writer never waits.
+
+atomic_uint vt_seq[VT_MAX];
+atomic_uint vt_gen;
+
+// Fleet-wide scans (bounding box, speed, stale vessels) run over copies of the scanned fields kept as
+// separate arrays in the order of vt: vs_x[i] belongs to vt[i].  Vessels without the field hold values
+// no query matches.  The loops test 64 slots at a time into a byte per slot, which compilers vectorize,
+// and the hits are collected 8 bytes at a time.  vs_ arrays are read on the writer's thread, another
+// thread gets candidate indexes to confirm with vessel_read_at.
+
+#define VS_BLK  64
+#define VS_NONE (-0x7FFFFFFF-1)   // no position / speed
+#define VS_NEVER 0x7FFFFFFF       // no time yet
+
+int vs_lon[VT_MAX], vs_lat[VT_MAX], vs_sog[VT_MAX];  // as in vessel
+int vs_t[VT_MAX];      // last update [0.1 s] after vs_t0
+double vs_t0;
+
+void vt_begin(atomic_uint *s)
+{
+    atomic_store_explicit(s, atomic_load_explicit(s, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
 }
 
-// =========================================== IQ data from socket ==========================================
+void vt_end(atomic_uint *s) { atomic_store_explicit(s, atomic_load_explicit(s, memory_order_relaxed) + 1, memory_order_release); }
 
-#if defined(__linux__) || defined(__APPLE__)
-    #include <sys/types.h>
-    #include <sys/socket.h>
-    #include <netdb.h>
-    #include <unistd.h>
+void http_changed(int mmsi, int lon0, int lat0, int lon1, int lat1);  // HTTP query API, below
 
-    int tcp_recv(char *host, char *port)
-    {
-        int sock = 0, client_fd;
-        struct addrinfo *result = NULL, *ptr = NULL, hints;
+unsigned vt_slot(int mmsi) { return ((unsigned)mmsi * 2654435761u) & (VT_HASH-1); }
 
-        memset (&hints, 0, sizeof (hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_protocol = IPPROTO_TCP;
+vessel *vessel_find(int mmsi)
+{
+    for(unsigned h = vt_slot(mmsi); vt_hash[h]; h = (h+1) & (VT_HASH-1))
+        if (vt[vt_hash[h]-1].mmsi == mmsi) return &vt[vt_hash[h]-1];
+    return NULL;
+}
 
-        if (getaddrinfo(host, port, &hints, &result) != 0) { return 2; }
+vessel *vessel_get(int mmsi)  // find or insert, NULL if the table is full
+{
+    unsigned h = vt_slot(mmsi);
+    for(; vt_hash[h]; h = (h+1) & (VT_HASH-1))
+        if (vt[vt_hash[h]-1].mmsi == mmsi) return &vt[vt_hash[h]-1];
+
+    if (vt_n == VT_MAX) return NULL;
+    vessel *v = &vt[vt_n];
+    vt_begin(&vt_seq[vt_n]);  memset(v, 0, sizeof(*v));  v->mmsi = mmsi;  vt_end(&vt_seq[vt_n]);
+    vs_lon[vt_n] = vs_lat[vt_n] = vs_sog[vt_n] = VS_NONE;  vs_t[vt_n] = VS_NEVER;
+    vt_hash[h] = ++vt_n;
+    return v;
+}
 
-        for(ptr=result; ptr != NULL; ptr=ptr->ai_next)  // Attempt to connect to an address until one succeeds
-        {
-            if ((sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol)) < 0)
-            {
-                printf("Socket creation error\n");
-                return 3;
-            }
-            if ((client_fd = connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen)) < 0)
-            {
-                close(client_fd);
-                printf("Connection Failed\nDid you run\n$ rtl_tcp -f 162e6 -s 300000 -a 127.0.0.1 -p 2345 -g 48.0\n");
-                continue;
-            }
-            break;
-        }
+void vessel_remove(vessel *v)
+{
+    unsigned h = vt_slot(v->mmsi), j = h;
+    while (vt[vt_hash[h]-1].mmsi != v->mmsi) h = (h+1) & (VT_HASH-1);
 
-        int n;
-        static unsigned char buff[2*NIQ];
-        if ((n=read(sock, buff, 2*NIQ)) > 0) printf("\n === (%d bytes) %s === \n\n", n, buff);  // initial packet
-        printf(" MID    MMSI      longitude   latitude     speed    course\n");
-        printf("-------------------------------------------------------------\n");
-        while((n=read(sock, buff, 2*NIQ)) > 0) proces_buff(n/2, buff);
+    vt_begin(&vt_gen);
 
-        close(client_fd);
-        return n;
+    for(j=h; vt_hash[j = (j+1) & (VT_HASH-1)]; )  // backward shift deletion
+    {
+        unsigned k = vt_slot(vt[vt_hash[j]-1].mmsi);  // home of the entry at j
+        if (h < j ? (h < k && k <= j) : (h < k || k <= j)) continue;
+        vt_hash[h] = vt_hash[j];  h = j;
     }
-#elif defined(_WIN32)
-    #include <winsock2.h>
-    #include <ws2tcpip.h>
-    #pragma comment (lib, "Ws2_32.lib")
+    vt_hash[h] = 0;
 
-    int tcp_recv(char *host, char *port)
+    if (!v->dirty && vt_ndirty < 2*VT_MAX) vt_dirty[vt_ndirty++] = v->mmsi;  // report it dropped
+    timer_cancel(&v->expire);
+    http_changed(v->mmsi, vs_lon[v - vt], vs_lat[v - vt], VS_NONE, VS_NONE);
+
+    int i = v - vt;
+    if (i != --vt_n)  // move the last vessel into the gap
     {
-        WSADATA wsaData;
-        SOCKET sock = INVALID_SOCKET;
-        struct addrinfo *result = NULL, *ptr = NULL, hints;
+        vt_begin(&vt_seq[i]);  *v = vt[vt_n];  vt_end(&vt_seq[i]);
+        vs_lon[i] = vs_lon[vt_n];  vs_lat[i] = vs_lat[vt_n];  vs_sog[i] = vs_sog[vt_n];  vs_t[i] = vs_t[vt_n];
+        timer_moved(&v->expire);
+        for(h = vt_slot(v->mmsi); vt_hash[h] != vt_n+1; h = (h+1) & (VT_HASH-1)) ;
+        vt_hash[h] = i+1;
+    }
+    vt_begin(&vt_seq[vt_n]);  vt[vt_n].mmsi = 0;  vt_end(&vt_seq[vt_n]);
+    vt_end(&vt_gen);
+}
 
-        if (WSAStartup(MAKEWORD(2,2), &wsaData)) return 1;
+void vessel_expire(timer *t) { vessel_remove((vessel *)((char *)t - offsetof(vessel, expire))); }
 
-        ZeroMemory(&hints, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_protocol = IPPROTO_TCP;
+int sp_kept;  double sp_kept_t;  // texts left by the last compaction, its time
 
-        if (getaddrinfo(host, port, &hints, &result) != 0) { WSACleanup();  return 2; }
+void vessel_compact_strings(double now)  // drop interned texts no vessel refers to any more
+{
+    static int keep[SP_MAX];
+    memset(keep, 0, sizeof(keep));
+    for(int i=0; i<vt_n; i++) { keep[vt[i].csgn] = keep[vt[i].name] = keep[vt[i].dest] = 1;  vt_begin(&vt_seq[i]); }  // texts move
+    str_compact(keep);
+    pcache_clear();
+    for(int i=0; i<vt_n; i++) { vt[i].csgn = keep[vt[i].csgn];  vt[i].name = keep[vt[i].name];  vt[i].dest = keep[vt[i].dest];  vt_end(&vt_seq[i]); }
+    sp_kept = sp_n;  sp_kept_t = now;
+}
 
-        for(ptr=result; ptr != NULL; ptr=ptr->ai_next)  // Attempt to connect to an address until one succeeds
-        { sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);  if (sock == INVALID_SOCKET) { WSACleanup();  return 3; }
-            if (connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen) == SOCKET_ERROR) { closesocket(sock); sock=INVALID_SOCKET; continue; }
-            break; }
+#define VT_SET(f, x, bit)  if (v->f != (x) || !(v->known & bit)) { v->f = (x);  d |= bit; }
 
-        freeaddrinfo(result);   if (sock == INVALID_SOCKET) { WSACleanup();  return 4; }
+vessel *vessel_update(AIS_msg *m)
+{
+    vessel *v = vessel_get(m->mmsi);  if (!v) return NULL;
+    unsigned d = 0, h5 = 2166136261u;
+    int lon0 = v->known & VF_POS ? v->lon : VS_NONE, lat0 = v->known & VF_POS ? v->lat : VS_NONE;
+    vt_begin(&vt_seq[v - vt]);
 
-        int n;
-        static unsigned char buff[2*NIQ];
-        if ((n=recv(sock, buff, 2*NIQ, 0)) > 0) printf("\n === (%d bytes) %s === \n\n", n, buff);  // initial packet
-        printf(" MID    MMSI      longitude   latitude     speed    course\n");
-        printf("-------------------------------------------------------------\n");
-        while((n=recv(sock, buff, 2*NIQ, MSG_WAITALL)) > 0) proces_buff(n/2, buff);
+    switch (m->id)
+    {
+        case 1: case 2: case 3:  if (v->lon != m->lon || v->lat != m->lat || !(v->known & VF_POS)) { v->lon = m->lon;  v->lat = m->lat;  d |= VF_POS; }
+                                 VT_SET(sog, m->sog, VF_SOG);
+                                 VT_SET(cog, m->cog, VF_COG);
+                                 VT_SET(hdg, m->hdg, VF_HDG);
+                                 VT_SET(status, m->status, VF_STATUS);
+                                 break;
 
-        closesocket(sock);
-        WSACleanup();
-        return n;
-    }
-#endif
+        case 4: if (v->lon != m->lon || v->lat != m->lat || !(v->known & VF_POS)) { v->lon = m->lon;  v->lat = m->lat;  d |= VF_POS; }
+                break;
 
+        case 5: for(int k=0; k<m->len; k++) h5 = (h5 ^ (k ? m->p[k] : m->p[k] & 0xFC)) * 16777619u;  // FNV-1a, repeat indicator cleared
+                if (v->h5 != h5 || v->imo != m->imo || v->type != m->type || v->draught != m->draught || v->bow != m->bow || v->stern != m->stern ||
+                    v->port != m->port || v->starboard != m->starboard || v->csgn != m->csgn ||
+                    v->name != m->name || v->dest != m->dest || !(v->known & VF_STATIC))
+                {
+                    v->imo = m->imo;  v->type = m->type;  v->draught = m->draught;
+                    v->bow = m->bow;  v->stern = m->stern;  v->port = m->port;  v->starboard = m->starboard;
+                    v->csgn = m->csgn;  v->name = m->name;  v->dest = m->dest;  v->h5 = h5;
+                    d |= VF_STATIC;
+                }
+                break;
+    }
+
+    if (d && !v->dirty && vt_ndirty < 2*VT_MAX) vt_dirty[vt_ndirty++] = v->mmsi;
+    v->dirty |= d;  v->known |= d;  v->last = d;
+    v->id = m->id;  v->t = m->t;
+
+    int i = v - vt;
+    if (!vs_t0) vs_t0 = floor(m->t);
+    if (d & VF_POS) { vs_lon[i] = v->lon;  vs_lat[i] = v->lat; }
+    if (d & VF_SOG) vs_sog[i] = v->sog;
+    vs_t[i] = (int)floor((m->t - vs_t0)*10);
+    vt_end(&vt_seq[i]);
+
+    if (m->id >= 1 && m->id <= 3) v->kept = tk_tol > 0 ? track_keep(&v->trk, m->t, m->lon, m->lat, m->sog, m->cog) : (d & VF_POS) != 0;
+    else v->kept = (d & VF_POS) != 0;
+    if (v->kept) track_add(&v->trk, v->mmsi, m->t, v->lon, v->lat, m->id == 4 ? 0 : m->sog, m->id == 4 ? 0 : m->cog);
+    http_changed(v->mmsi, lon0, lat0, vs_lon[i], vs_lat[i]);  // its time at least, maybe its track
+    timer_set(&v->expire, m->t + VT_TTL, vessel_expire);
+    return v;
+}
+
+int vs_collect(unsigned char *hit, int *idx)  // indexes of the slots hit, returns their number
+{
+    int n = 0;
+    for(int i=0; i<vt_n; i+=8)
+    {
+        unsigned long long w;  memcpy(&w, &hit[i], 8);
+        if (w) for(int j=i; j<i+8 && j<vt_n; j++) if (hit[j]) idx[n++] = j;
+    }
+    return n;
+}
+
+unsigned char vs_hit[VT_MAX];
+
+int vs_bbox(int lon0, int lat0, int lon1, int lat1, int *idx)  // positions inside lon0..lon1, lat0..lat1 [1/10000 min]
+{
+    unsigned x0 = lon0, xw = (unsigned)lon1 - x0, y0 = lat0, yw = (unsigned)lat1 - y0;  // one compare per range
+    for(int b=0; b<vt_n; b+=VS_BLK)
+        for(int j=b; j<b+VS_BLK; j++) vs_hit[j] = ((unsigned)vs_lon[j] - x0 <= xw) & ((unsigned)vs_lat[j] - y0 <= yw);
+    return vs_collect(vs_hit, idx);
+}
+
+int vs_speed(int sog0, int sog1, int *idx)  // speed over ground within sog0..sog1 [0.1 kn]
+{
+    unsigned s0 = sog0, sw = (unsigned)sog1 - s0;
+    for(int b=0; b<vt_n; b+=VS_BLK)
+        for(int j=b; j<b+VS_BLK; j++) vs_hit[j] = (unsigned)vs_sog[j] - s0 <= sw;
+    return vs_collect(vs_hit, idx);
+}
+
+int vs_stale(double before, int *idx)  // nothing received since before [UTC s]
+{
+    int tb = (int)fmax(fmin(floor((before - vs_t0)*10), VS_NEVER - 1.0), -VS_NEVER);
+    for(int b=0; b<vt_n; b+=VS_BLK)
+        for(int j=b; j<b+VS_BLK; j++) vs_hit[j] = vs_t[j] < tb;
+    return vs_collect(vs_hit, idx);
+}
+
+typedef struct  // copy of a vessel for other threads, texts included
+{
+    int mmsi, id;  double t;
+    int lon, lat, sog, cog, hdg, status;
+    int imo, type, bow, stern, port, starboard, draught;
+    unsigned known;
+    char csgn[8], name[21], dest[21];
+} vessel_snap;
+
+int vessel_read_at(int i, vessel_snap *s)  // any thread: consistent copy of vt[i], 0 if the slot is empty
+{
+    vessel *v = &vt[i];
+    for(;;)
+    {
+        unsigned q = atomic_load_explicit(&vt_seq[i], memory_order_acquire);
+        if (q & 1) continue;
+
+        s->mmsi = v->mmsi;  s->id = v->id;  s->t = v->t;
+        s->lon = v->lon;  s->lat = v->lat;  s->sog = v->sog;  s->cog = v->cog;  s->hdg = v->hdg;  s->status = v->status;
+        s->imo = v->imo;  s->type = v->type;  s->bow = v->bow;  s->stern = v->stern;
+        s->port = v->port;  s->starboard = v->starboard;  s->draught = v->draught;  s->known = v->known;
+        int c = v->csgn, n = v->name, d = v->dest;
+        memcpy(s->csgn, str_of((unsigned)c < SP_MAX ? c : 0), 8);  s->csgn[7] = 0;
+        memcpy(s->name, str_of((unsigned)n < SP_MAX ? n : 0), 21);  s->name[20] = 0;
+        memcpy(s->dest, str_of((unsigned)d < SP_MAX ? d : 0), 21);  s->dest[20] = 0;
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&vt_seq[i], memory_order_relaxed) == q) return s->mmsi != 0;
+    }
+}
+
+int vessel_read(int mmsi, vessel_snap *s)  // any thread: consistent copy of the vessel, 0 if it is not tracked
+{
+    for(;;)
+    {
+        unsigned g = atomic_load_explicit(&vt_gen, memory_order_acquire);
+        unsigned h = vt_slot(mmsi);
+        int k = 0;
+        for(int p=0; p<VT_HASH && (k = atomic_load_explicit(&vt_hash[h], memory_order_acquire)); p++, h = (h+1) & (VT_HASH-1))
+            if (vt[k-1].mmsi == mmsi) break;  // candidate, checked on the copy
+
+        if (k && vessel_read_at(k-1, s) && s->mmsi == mmsi) return 1;
+        atomic_thread_fence(memory_order_acquire);
+        if (!(g & 1) && atomic_load_explicit(&vt_gen, memory_order_relaxed) == g) return 0;
+    }
+}
+
+char *json_vessel(char *o, vessel *v, unsigned f)  // fields f of vessel v, o must hold 512 bytes
+{
+    *o++ = '{';
+    o = j_int(o, "mmsi", v->mmsi, 0);
+    o = j_int(o, "t", (long long)(v->t*1000 + 0.5), 3);
+    if (f & VF_POS) { o = j_int(o, "lon", deg6(v->lon), 6);  o = j_int(o, "lat", deg6(v->lat), 6); }
+    if (f & VF_SOG) o = j_int(o, "sog", v->sog, 1);
+    if (f & VF_COG) o = j_int(o, "cog", v->cog, 1);
+    if (f & VF_HDG) o = j_int(o, "hdg", v->hdg, 0);
+    if (f & VF_STATUS) o = j_int(o, "status", v->status, 0);
+    if (f & VF_STATIC)
+    {
+        o = j_int(o, "imo", v->imo, 0);
+        o = j_str(o, "callsign", str_of(v->csgn));
+        o = j_str(o, "name", str_of(v->name));
+        o = j_int(o, "type", v->type, 0);
+        o = j_int(o, "length", v->bow + v->stern, 0);  o = j_int(o, "width", v->port + v->starboard, 0);
+        o = j_int(o, "draught", v->draught, 1);
+        o = j_str(o, "destination", str_of(v->dest));
+    }
+    *o++ = '}';
+    return o;
+}
+
+// ================================= Output throttling =====================================
+//
+// -Q metres,seconds : a position report (1, 2, 3, 4) is output only when the vessel moved more than
+// metres from the last position output, or seconds passed since; message 5 only when its content changed.
+
+double th_dist, th_interval = -1;  // th_interval < 0 : off
+long long th_passed, th_dropped;
+
+int throttle_pass(vessel *v, AIS_msg *m)
+{
+    switch (m->id)
+    {
+        case 1: case 2: case 3: case 4:
+        {
+            double dy = m->lat - v->out_lat, dx = (m->lon - v->out_lon) * cos(m->lat * (M_PI/180/600000));
+            double d = sqrt(dx*dx + dy*dy) * 0.1852;  // 1/10000 min = 0.1852 m
+            if (v->out_t && d <= th_dist && m->t - v->out_t < th_interval) return 0;
+            v->out_lon = m->lon;  v->out_lat = m->lat;  v->out_t = m->t;
+            return 1;
+        }
+        case 5:  return (v->last & VF_STATIC) != 0;
+        default: return 1;
+    }
+}
+
+// ================================= Binary uplink =====================================
+//
+// -U host:port | file : compact stream of the decoded traffic for metered backhaul.  Records are
+// collected into batches (one per IQ buffer, at most UP_BATCH bytes) which are LZ77 compressed
+// when that helps:
+//
+//   batch   0xE5, flags (1 = compressed), varint raw length, varint stored length, varint records,
+//           varint base time [ms UTC], stored bytes
+//   record  tag, varint time after base [ms], then by tag & 7
+//     UP_POS   position report: new MMSI - varint mmsi, zigzag lon lat, sog cog hdg status, zigzag rot, sec|acc<<6
+//                               known    - varint index, change mask, zigzag deltas of the changed fields
+//     UP_BASE  base station:    mmsi or index, zigzag lon lat (deltas if known), year month day hour minute second acc
+//     UP_STAT  static data:     mmsi or index, imo type bow stern port starboard eta(4) draught, 3 x 6-bit text
+//     UP_RAW   other messages:  length, payload
+//     UP_RESET MMSI indexes restart from 0
+//   tag bit 3 = channel B, bit 4 = new MMSI (it gets the next index), bits 5-6 = message ID - 1 of UP_POS
+//
+// Every MMSI gets a small index on its first record of a stream, positions are then sent as
+// deltas to the values last sent for that index.  Every UP_KEY seconds a batch starts with UP_RESET,
+// so it decodes without the ones before.  A lost TCP uplink is reconnected as a new stream.
+
+#define UP_POS   0
+#define UP_BASE  1
+#define UP_STAT  2
+#define UP_RAW   3
+#define UP_RESET 4
+
+#define UP_BATCH  8192
+#define UP_MAXIDX (1<<20)  // indexes before a reset
+#define UP_KEY    60       // [s] between keyframes
+#define UP_RETRY  5        // [s] between reconnect steps
+
+FILE *up_f;
+char *up_dst;          // host:port of a TCP uplink, NULL for a file
+int up_conn = -1;      // socket of a reconnect in progress
+double up_key;         // time of the next keyframe
+long long up_lost;     // connections lost
+timer up_retry;
+int up_epoch = 1, up_next;  // stream generation, next MMSI index
+unsigned char up_buf[UP_BATCH + 256], *up_o = up_buf;
+int up_count;
+long long up_base, up_bytes, up_nmea, up_msgs;
+
+unsigned char *put_var(unsigned char *o, unsigned long long v) { while (v >= 128) { *o++ = v | 128;  v >>= 7; }  *o++ = v;  return o; }
+unsigned char *put_zz(unsigned char *o, long long v) { return put_var(o, ((unsigned long long)v << 1) ^ (v >> 63)); }
+
+unsigned long long get_var(unsigned char **i, unsigned char *e)  // *i = e+1 on truncated input
+{
+    unsigned long long v = 0;
+    for(int s=0; *i < e && s < 64; s+=7) { unsigned char b = *(*i)++;  v |= (unsigned long long)(b & 127) << s;  if (!(b & 128)) return v; }
+    *i = e+1;
+    return 0;
+}
+long long get_zz(unsigned char **i, unsigned char *e) { unsigned long long v = get_var(i, e);  return (long long)(v >> 1) ^ -(long long)(v & 1); }
+
+unsigned char *put_text(unsigned char *o, char *s)  // length and 6-bit codes, '@' padding dropped
+{
+    int n = strlen(s);  while (n && s[n-1] == '@') n--;
+    *o++ = n;  memset(o, 0, (n*6+7)/8);
+    for(int i=0; i<n; i++) int2bits(o, 6*i, 6, s[i] & 63);
+    return o + (n*6+7)/8;
+}
+
+unsigned char *lz_token(unsigned char *o, unsigned char *lit, int nlit, int off, int len)
+{
+    *o++ = (nlit < 15 ? nlit : 15) << 4 | (len ? (len-4 < 15 ? len-4 : 15) : 0);
+    if (nlit >= 15) o = put_var(o, nlit-15);
+    memcpy(o, lit, nlit);  o += nlit;
+    if (len) { *o++ = off;  *o++ = off >> 8;  if (len-4 >= 15) o = put_var(o, len-4-15); }
+    return o;
+}
+
+int lz_compress(unsigned char *in, int n, unsigned char *out)  // LZ4 style tokens: literal run, 16 bit offset, match length
+{
+    static int ht[4096];  // position+1 of the last 4 bytes with this hash
+    unsigned char *o = out;
+    int i = 0, lit = 0;
+    memset(ht, 0, sizeof(ht));
+
+    while (i + 4 <= n)
+    {
+        unsigned x;  memcpy(&x, in+i, 4);
+        unsigned h = (x * 2654435761u) >> 20;
+        int c = ht[h] - 1;  ht[h] = i + 1;
+        if (c >= 0 && i - c < 65536 && !memcmp(in+c, in+i, 4))
+        {
+            int len = 4;  while (i+len < n && in[c+len] == in[i+len]) len++;
+            o = lz_token(o, in+lit, i-lit, i-c, len);
+            i += len;  lit = i;
+        }
+        else i++;
+    }
+    return lz_token(o, in+lit, n-lit, 0, 0) - out;
+}
+
+int lz_decompress(unsigned char *in, int n, unsigned char *out, int cap)  // -1 if malformed
+{
+    unsigned char *e = in+n, *o = out;
+    while (in < e)
+    {
+        int t = *in++, nl = t >> 4, ml = (t & 15) + 4;
+        if (nl == 15) nl += get_var(&in, e);
+        if (in > e || nl > e-in || nl > out+cap-o) return -1;
+        memcpy(o, in, nl);  o += nl;  in += nl;
+        if (in == e) break;
+
+        if (e-in < 2) return -1;
+        int off = in[0] | in[1]<<8;  in += 2;
+        if ((t & 15) == 15) ml += get_var(&in, e);
+        if (in > e || off == 0 || off > o-out || ml > out+cap-o) return -1;
+        while (ml--) { *o = o[-off];  o++; }  // may overlap
+    }
+    return o - out;
+}
+
+int dst_connect(char *dst, int nb);
+
+void uplink_retry(timer *t)  // one step of a reconnect: start a non-blocking connect, or see if it has finished
+{
+    double now = clk_t0 + (double)clk_smp/RATE;
+#if defined(__linux__) || defined(__APPLE__)
+    if (up_conn >= 0)
+    {
+        struct pollfd p = { up_conn, POLLOUT, 0 };
+        int e = 0;  socklen_t l = sizeof(e);
+        if (poll(&p, 1, 0) == 0) { timer_set(t, now + UP_RETRY, uplink_retry);  return; }  // still connecting
+        getsockopt(up_conn, SOL_SOCKET, SO_ERROR, &e, &l);
+        fcntl(up_conn, F_SETFL, 0);
+        if (!e && (up_f = fdopen(up_conn, "wb")))
+        {
+            up_conn = -1;
+            up_epoch++;  up_next = 0;  up_key = 0;  // a new stream: the receiver knows no indexes yet
+            return;
+        }
+        close(up_conn);
+    }
+    up_conn = dst_connect(up_dst, 1);
+#endif
+    timer_set(t, now + UP_RETRY, uplink_retry);
+}
+
+void uplink_lost(void)  // the TCP uplink broke: drop it and what is batched, reconnect on the sample clock
+{
+    fclose(up_f);  up_f = NULL;  up_lost++;
+    up_o = up_buf;  up_count = 0;
+    timer_set(&up_retry, clk_t0 + (double)clk_smp/RATE + UP_RETRY, uplink_retry);
+}
+
+void uplink_flush(void)
+{
+    static unsigned char z[2*UP_BATCH + 512], h[32];
+    if (!up_count) return;
+
+    int raw = up_o - up_buf, zn = lz_compress(up_buf, raw, z), comp = zn < raw;
+    unsigned char *o = h;
+    *o++ = 0xE5;  *o++ = comp;
+    o = put_var(o, raw);  o = put_var(o, comp ? zn : raw);  o = put_var(o, up_count);  o = put_var(o, up_base);
+
+    fwrite(h, 1, o-h, up_f);  fwrite(comp ? z : up_buf, 1, comp ? zn : raw, up_f);
+    up_bytes += (o-h) + (comp ? zn : raw);
+    up_o = up_buf;  up_count = 0;
+    if ((fflush(up_f) || ferror(up_f)) && up_dst) uplink_lost();
+}
+
+void uplink_AIS_message(AIS_msg *m, vessel *v)
+{
+    long long t = (long long)(m->t*1000 + 0.5);
+    if (!up_count) up_base = t;
+    if (t < up_base) t = up_base;
+
+    unsigned char *o = up_o, *tag;
+    if ((v && v->up_epoch != up_epoch && up_next == UP_MAXIDX) || (!up_count && m->t >= up_key))  // out of indexes, or a keyframe
+    {
+        *o++ = UP_RESET;  *o++ = 0;  up_count++;  up_epoch++;  up_next = 0;
+        up_key = m->t + UP_KEY;
+    }
+
+    tag = o++;
+    o = put_var(o, t - up_base);
+
+    if (!v || m->id < 1 || m->id > 5)
+    {
+        *tag = UP_RAW;
+        *o++ = m->len;  memcpy(o, m->p, m->len);  o += m->len;
+    }
+    else
+    {
+        int known = v->up_epoch == up_epoch;
+        if (!known)
+        {
+            v->up_epoch = up_epoch;  v->up_idx = up_next++;
+            o = put_var(o, m->mmsi);
+        }
+        else o = put_var(o, v->up_idx);
+        *tag = (known ? 0 : 16) | (m->ch == 2 ? 8 : 0);
+
+        switch (m->id)
+        {
+            case 1: case 2: case 3:
+                *tag |= UP_POS | (m->id-1) << 5;
+                if (!known)
+                {
+                    o = put_zz(o, m->lon);  o = put_zz(o, m->lat);
+                    o = put_var(o, m->sog);  o = put_var(o, m->cog);  o = put_var(o, m->hdg);  o = put_var(o, m->status);  o = put_zz(o, m->rot);
+                }
+                else
+                {
+                    unsigned char *mask = o++;  *mask = 0;
+                    if (m->lon != v->up_lon || m->lat != v->up_lat) { *mask |= 1;  o = put_zz(o, m->lon - v->up_lon);  o = put_zz(o, m->lat - v->up_lat); }
+                    if (m->sog != v->up_sog) { *mask |= 2;   o = put_zz(o, m->sog - v->up_sog); }
+                    if (m->cog != v->up_cog) { *mask |= 4;   o = put_zz(o, m->cog - v->up_cog); }
+                    if (m->hdg != v->up_hdg) { *mask |= 8;   o = put_zz(o, m->hdg - v->up_hdg); }
+                    if (m->status != v->up_status) { *mask |= 16;  o = put_var(o, m->status); }
+                    if (m->rot != v->up_rot) { *mask |= 32;  o = put_zz(o, m->rot); }
+                }
+                *o++ = m->sec | m->acc << 6;
+                v->up_lon = m->lon;  v->up_lat = m->lat;  v->up_sog = m->sog;  v->up_cog = m->cog;
+                v->up_hdg = m->hdg;  v->up_status = m->status;  v->up_rot = m->rot;
+                break;
+
+            case 4:
+                *tag |= UP_BASE;
+                o = put_zz(o, m->lon - (known ? v->up_lon : 0));  o = put_zz(o, m->lat - (known ? v->up_lat : 0));
+                o = put_var(o, m->year);  *o++ = m->month;  *o++ = m->day;  *o++ = m->hour;  *o++ = m->minute;  *o++ = m->second | m->acc << 6;
+                v->up_lon = m->lon;  v->up_lat = m->lat;
+                break;
+
+            case 5:
+                *tag |= UP_STAT;
+                o = put_var(o, m->imo);  *o++ = m->type;  o = put_var(o, m->bow);  o = put_var(o, m->stern);  *o++ = m->port;  *o++ = m->starboard;
+                *o++ = m->eta_month;  *o++ = m->eta_day;  *o++ = m->eta_hour;  *o++ = m->eta_minute;  *o++ = m->draught;
+                o = put_text(o, str_of(m->csgn));  o = put_text(o, str_of(m->name));  o = put_text(o, str_of(m->dest));
+                break;
+        }
+    }
+
+    static char nmea[256];
+    up_nmea += nmea_format(nmea, m->p, m->len, m->ch, 0) - nmea;  up_msgs++;
+    up_o = o;  up_count++;
+    if (up_o - up_buf > UP_BATCH) uplink_flush();
+}
+
+int dst_connect(char *dst, int nb)  // TCP socket to host:port, still connecting when it returns if nb; -1 on failure
+{
+#if defined(__linux__) || defined(__APPLE__)
+    char host[256], *port = strrchr(dst, ':');
+    struct addrinfo hints, *r;  memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;  hints.ai_socktype = SOCK_STREAM;
+    snprintf(host, sizeof(host), "%.*s", (int)(port - dst), dst);
+    if (getaddrinfo(host, port+1, &hints, &r)) return -1;
+    int sock = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+    if (sock >= 0 && nb) fcntl(sock, F_SETFL, O_NONBLOCK);
+    if (sock >= 0 && connect(sock, r->ai_addr, r->ai_addrlen) < 0 && !(nb && errno == EINPROGRESS)) { close(sock);  sock = -1; }
+    freeaddrinfo(r);
+    signal(SIGPIPE, SIG_IGN);
+    return sock;
+#else
+    return -1;
+#endif
+}
+
+FILE *dst_open(char *dst)  // host:port or file, NULL on failure
+{
+    if (!strrchr(dst, ':')) return fopen(dst, "wb");
+    int sock = dst_connect(dst, 0);
+    return sock < 0 ? NULL : fdopen(sock, "wb");
+}
+
+int uplink_open(char *dst)
+{
+    up_dst = strrchr(dst, ':') ? dst : NULL;
+    return !(up_f = dst_open(dst));
+}
+
+// Receiving side: the state of a stream, fed with whatever bytes arrived.
+
+typedef struct { int mmsi, lon, lat, sog, cog, hdg, status, rot; } up_state;
+
+typedef struct
+{
+    up_state *s;  int ns, cap;      // by MMSI index
+    unsigned char in[2*UP_BATCH + 512];  int nin;
+    unsigned char pay[56];
+    void (*emit)(AIS_msg *m);
+} up_dec;
+
+int up_record(up_dec *d, unsigned char **i, unsigned char *e, long long base, AIS_msg *m)  // 1 a message in m, 2 a reset, 0 if malformed
+{
+    if (*i >= e) return 0;
+    int tag = *(*i)++;
+    memset(m, 0, sizeof(*m));
+    m->t = (base + (long long)get_var(i, e)) * 0.001;
+    m->ch = tag & 8 ? 2 : 1;
+
+    if ((tag & 7) == UP_RESET) { d->ns = 0;  return *i <= e ? 2 : 0; }
+    if ((tag & 7) == UP_RAW)
+    {
+        if (*i >= e || **i > 56 || e - (*i+1) < **i) return 0;
+        m->len = *(*i)++;  memcpy(d->pay, *i, m->len);  *i += m->len;
+        m->p = d->pay;
+        parse_AIS_message(m->p, m);
+        return 1;
+    }
+
+    up_state *s;
+    if (tag & 16)  // new MMSI
+    {
+        if (d->ns == d->cap) { d->cap = d->cap ? 2*d->cap : 1024;  if (d->cap > UP_MAXIDX || !(d->s = realloc(d->s, d->cap * sizeof(up_state)))) return 0; }
+        s = &d->s[d->ns++];  memset(s, 0, sizeof(*s));
+        s->mmsi = get_var(i, e);
+    }
+    else
+    {
+        unsigned long long k = get_var(i, e);
+        if (k >= (unsigned)d->ns) return 0;
+        s = &d->s[k];
+    }
+    m->mmsi = s->mmsi;
+
+    switch (tag & 7)
+    {
+        case UP_POS:
+            m->id = (tag >> 5) + 1;
+            if (tag & 16)
+            {
+                s->lon = get_zz(i, e);  s->lat = get_zz(i, e);
+                s->sog = get_var(i, e);  s->cog = get_var(i, e);  s->hdg = get_var(i, e);  s->status = get_var(i, e);  s->rot = get_zz(i, e);
+            }
+            else
+            {
+                int mask = *i < e ? *(*i)++ : 0;
+                if (mask & 1) { s->lon += get_zz(i, e);  s->lat += get_zz(i, e); }
+                if (mask & 2)  s->sog += get_zz(i, e);
+                if (mask & 4)  s->cog += get_zz(i, e);
+                if (mask & 8)  s->hdg += get_zz(i, e);
+                if (mask & 16) s->status = get_var(i, e);
+                if (mask & 32) s->rot = get_zz(i, e);
+            }
+            if (*i >= e) return 0;
+            m->sec = **i & 63;  m->acc = *(*i)++ >> 6;
+            m->lon = s->lon;  m->lat = s->lat;  m->sog = s->sog;  m->cog = s->cog;  m->hdg = s->hdg;  m->status = s->status;  m->rot = s->rot;
+            break;
+
+        case UP_BASE:
+            m->id = 4;
+            s->lon += get_zz(i, e);  s->lat += get_zz(i, e);
+            m->lon = s->lon;  m->lat = s->lat;
+            m->year = get_var(i, e);
+            if (e - *i < 5) return 0;
+            m->month = *(*i)++;  m->day = *(*i)++;  m->hour = *(*i)++;  m->minute = *(*i)++;
+            m->second = **i & 63;  m->acc = *(*i)++ >> 6;
+            break;
+
+        case UP_STAT:
+        {
+            m->id = 5;
+            m->imo = get_var(i, e);  if (*i >= e) return 0;  m->type = *(*i)++;
+            m->bow = get_var(i, e);  m->stern = get_var(i, e);
+            if (e - *i < 7) return 0;
+            m->port = *(*i)++;  m->starboard = *(*i)++;
+            m->eta_month = *(*i)++;  m->eta_day = *(*i)++;  m->eta_hour = *(*i)++;  m->eta_minute = *(*i)++;  m->draught = *(*i)++;
+            int *f[3] = { &m->csgn, &m->name, &m->dest }, w[3] = { 42, 120, 120 };
+            for(int k=0; k<3; k++)
+            {
+                unsigned char b[16] = {0};
+                if (*i >= e || **i*6 > w[k] || e - (*i+1) < (**i*6+7)/8) return 0;
+                int n = *(*i)++;  memcpy(b, *i, (n*6+7)/8);  *i += (n*6+7)/8;
+                if (n*6 % 8) b[n*6/8] &= 0xFF << (8 - n*6 % 8);
+                *f[k] = str_intern(b, 0, w[k]);
+            }
+            break;
+        }
+        default: return 0;
+    }
+    if (*i > e) return 0;
+
+    m->len = build_AIS_message(m, d->pay);  m->p = d->pay;
+    return 1;
+}
+
+int uplink_feed(up_dec *d, unsigned char *b, int n)  // bytes of a stream, -1 if it is malformed
+{
+    static unsigned char raw[2*UP_BATCH + 512];
+    AIS_msg m;
+
+    while (n > 0)
+    {
+        int k = n < (int)sizeof(d->in) - d->nin ? n : (int)sizeof(d->in) - d->nin;
+        memcpy(d->in + d->nin, b, k);  d->nin += k;  b += k;  n -= k;
+
+        for(;;)  // complete batches
+        {
+            unsigned char *i = d->in, *e = d->in + d->nin;
+            if (i+2 > e) break;
+            if (i[0] != 0xE5) return -1;
+            int comp = i[1];  i += 2;
+            long long nraw = get_var(&i, e), nst = get_var(&i, e), cnt = get_var(&i, e), base = get_var(&i, e);
+            if (i > e) break;  // header incomplete
+            if (nraw > (long long)sizeof(raw) || nst > (long long)sizeof(d->in) - 32) return -1;
+            if (e - i < nst) break;
+
+            unsigned char *r = i;  long long nr = nst;
+            if (comp && (nr = lz_decompress(i, nst, raw, sizeof(raw))) != nraw) return -1;
+            if (comp) r = raw;
+
+            unsigned char *ri = r;
+            for(int c=0; c<cnt; c++) { int k = up_record(d, &ri, r + nr, base, &m);  if (!k) return -1;  if (k == 1) d->emit(&m); }
+
+            i += nst;
+            memmove(d->in, i, e - i);  d->nin = e - i;
+        }
+    }
+    return 0;
+}
+
+// ================================= WebSocket live feed =====================================
+//
+// Once per tick the vessels changed since the previous tick are serialized into one text frame
+// {"t":..,"vessels":[{"mmsi":..,<changed fields>},..]} which is shared by all clients.  A client
+// joining (or one whose socket fell behind) is sent the full picture in frames of the same format,
+// then continues with the shared deltas.
+
+#define WS_CLIENTS 128
+#define WS_OUT     (256*1024)  // per client backlog
+#define WS_FRAME   60000       // frame payload before it is closed, < 64k
+
+typedef struct
+{
+    int fd, open;       // fd 0 = unused slot, open after handshake
+    int snap;           // next vessel of the full picture to send, -1 = done
+    int nin, nout;
+    char in[1024], out[WS_OUT];
+} ws_client;
+
+int ws_fd = -1;          // -W port : listening socket
+double ws_period = 1.0;  // tick [s]
+double ws_last;
+ws_client ws[WS_CLIENTS];
+
+#if defined(__linux__) || defined(__APPLE__)
+
+void sha1(unsigned char *d, int n, unsigned char h[20])  // FIPS 180-1, n < 120
+{
+    unsigned int H[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 }, w[80];
+    unsigned char b[128] = {0};  memcpy(b, d, n);  b[n] = 0x80;
+    int nb = (n+8)/64 + 1;
+    for(int i=0; i<8; i++) b[nb*64-1-i] = (unsigned char)(((unsigned long long)n*8) >> (8*i));
+
+    for(int k=0; k<nb; k++)
+    {
+        for(int i=0; i<16; i++) w[i] = b[k*64+4*i]<<24 | b[k*64+4*i+1]<<16 | b[k*64+4*i+2]<<8 | b[k*64+4*i+3];
+        for(int i=16; i<80; i++) { unsigned x = w[i-3]^w[i-8]^w[i-14]^w[i-16];  w[i] = x<<1 | x>>31; }
+        unsigned a=H[0], bb=H[1], c=H[2], dd=H[3], e=H[4];
+        for(int i=0; i<80; i++)
+        {
+            unsigned f = i<20 ? ((bb&c) | (~bb&dd)) + 0x5A827999 : i<40 ? (bb^c^dd) + 0x6ED9EBA1 :
+                         i<60 ? ((bb&c) | (bb&dd) | (c&dd)) + 0x8F1BBCDC : (bb^c^dd) + 0xCA62C1D6;
+            unsigned t = (a<<5 | a>>27) + f + e + w[i];
+            e = dd;  dd = c;  c = bb<<30 | bb>>2;  bb = a;  a = t;
+        }
+        H[0]+=a;  H[1]+=bb;  H[2]+=c;  H[3]+=dd;  H[4]+=e;
+    }
+    for(int i=0; i<20; i++) h[i] = H[i/4] >> (24 - 8*(i%4));
+}
+
+char *base64(char *o, unsigned char *d, int n)
+{
+    const char *b = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for(int i=0; i<n; i+=3)
+    {
+        int v = d[i]<<16 | (i+1<n ? d[i+1]<<8 : 0) | (i+2<n ? d[i+2] : 0);
+        *o++ = b[v>>18];  *o++ = b[(v>>12)&63];
+        *o++ = i+1<n ? b[(v>>6)&63] : '=';  *o++ = i+2<n ? b[v&63] : '=';
+    }
+    *o = 0;
+    return o;
+}
+
+int ws_open(char *port)
+{
+    struct sockaddr_in a;  memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;  a.sin_port = htons(atoi(port));  a.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int one = 1;
+    if ((ws_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) return -1;
+    setsockopt(ws_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(ws_fd, (struct sockaddr *)&a, sizeof(a)) < 0 || listen(ws_fd, 16) < 0) { close(ws_fd);  ws_fd = -1;  return -1; }
+    fcntl(ws_fd, F_SETFL, O_NONBLOCK);
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+void ws_close(ws_client *c) { close(c->fd);  c->fd = c->open = c->nin = c->nout = 0; }
+
+void ws_flush(ws_client *c)
+{
+    if (!c->nout) return;
+    int k = send(c->fd, c->out, c->nout, 0);
+    if (k < 0) { if (errno != EAGAIN && errno != EWOULDBLOCK) ws_close(c);  return; }  // reset, gone: free the slot
+    memmove(c->out, c->out+k, c->nout-k);  c->nout -= k;
+}
+
+int ws_queue(ws_client *c, char *f, int n)  // whole frame or nothing
+{
+    if (c->nout + n > WS_OUT) return 0;
+    memcpy(c->out + c->nout, f, n);  c->nout += n;
+    return 1;
+}
+
+void ws_handshake(ws_client *c)
+{
+    c->in[c->nin] = 0;
+    if (!strstr(c->in, "\r\n\r\n")) { if (c->nin == sizeof(c->in)-1) ws_close(c);  return; }
+
+    char *k = c->in, key[128], acc[32], r[256];
+    while ((k = strchr(k, '\n')) && strncasecmp(++k, "Sec-WebSocket-Key:", 18)) ;
+    if (!k) { ws_close(c);  return; }
+    k += 18;  while (*k == ' ') k++;
+    int n = 0;  while (n < 24 && k[n] > ' ') { key[n] = k[n];  n++; }
+    memcpy(key+n, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36);
+
+    unsigned char h[20];  sha1((unsigned char *)key, n+36, h);  base64(acc, h, 20);
+    n = sprintf(r, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", acc);
+    ws_queue(c, r, n);
+    c->open = 1;  c->snap = 0;  c->nin = 0;
+}
+
+void ws_poll(void)  // accept clients, read handshakes and close requests, push backlogs
+{
+    int fd;
+    while ((fd = accept(ws_fd, NULL, NULL)) >= 0)
+    {
+        int k = 0;  while (k < WS_CLIENTS && ws[k].fd) k++;
+        if (k == WS_CLIENTS) { close(fd);  continue; }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        ws[k].fd = fd;
+    }
+
+    for(int k=0; k<WS_CLIENTS; k++)
+    {
+        ws_client *c = &ws[k];  if (!c->fd) continue;
+
+        int n = recv(c->fd, c->in + c->nin, sizeof(c->in)-1 - c->nin, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || (n > 0 && c->open && (c->in[0] & 15) == 8)) { ws_close(c);  continue; }  // disconnected, reset, close frame
+        if (n > 0 && !c->open) { c->nin += n;  ws_handshake(c); }
+        if (c->fd) ws_flush(c);
+    }
+}
+
+char *ws_begin(char *f, double t, const char *k)  // {"t":..,"<k>":[  after 10 bytes reserved for the frame header
+{
+    char *o = f + 10;
+    *o++ = '{';  o = j_int(o, "t", (long long)(t*1000 + 0.5), 3);  o = j_key(o, k);  *o++ = '[';
+    return o;
+}
+
+int ws_end(char *f, char *o)  // close the JSON and put text frame header in front of it, returns its offset in f
+{
+    *o++ = ']';  *o++ = '}';
+    int n = o - (f+10), h = n < 126 ? 2 : 4;
+    f[10-h] = (char)0x81;
+    if (h == 2) f[9] = n;
+    else { f[7] = 126;  f[8] = n>>8;  f[9] = n; }
+    return 10-h;
+}
+
+void ws_broadcast(char *f, char *o)
+{
+    int k = ws_end(f, o), n = o+2 - f - k;
+    for(int c=0; c<WS_CLIENTS; c++)
+        if (ws[c].open && ws[c].snap < 0 && !ws_queue(&ws[c], f+k, n)) ws[c].snap = 0;  // fell behind, resend the picture
+}
+
+int ws_tick(double t)  // returns 1 when the changes were sent
+{
+    static char f[10 + WS_FRAME + 512];
+    char *o = NULL;
+
+    ws_poll();
+    if (t - ws_last < ws_period) return 0;
+    ws_last = t;
+
+    for(int i=0; i<vt_ndirty; i++)  // shared delta frames
+    {
+        vessel *v = vessel_find(vt_dirty[i]);  if (!v || !v->dirty) continue;
+        if (!o) o = ws_begin(f, t, "vessels");  else *o++ = ',';
+        o = json_vessel(o, v, v->dirty);  v->dirty = 0;
+        if (o - f > WS_FRAME) { ws_broadcast(f, o);  o = NULL; }
+    }
+    if (o) { ws_broadcast(f, o);  o = NULL; }
+
+    for(int i=0; i<vt_ndirty; i++)  // {"t":..,"removed":[mmsi,..]}
+    {
+        if (vessel_find(vt_dirty[i])) continue;
+        if (!o) o = ws_begin(f, t, "removed");  else *o++ = ',';
+        o = j_num(o, vt_dirty[i], 0);
+        if (o - f > WS_FRAME) { ws_broadcast(f, o);  o = NULL; }
+    }
+    if (o) ws_broadcast(f, o);
+
+    for(int c=0; c<WS_CLIENTS; c++)  // full picture for new and lagging clients, as backlog space allows
+    {
+        ws_client *w = &ws[c];
+        while (w->open && w->snap >= 0 && w->nout < WS_OUT/2)
+        {
+            o = ws_begin(f, t, "vessels");
+            for(int first=1; w->snap < vt_n && o - f < WS_FRAME; first=0, w->snap++)
+            {
+                if (!first) *o++ = ',';
+                o = json_vessel(o, &vt[w->snap], vt[w->snap].known);
+            }
+            int k = ws_end(f, o);
+            ws_queue(w, f+k, o+2 - f - k);
+            if (w->snap == vt_n) w->snap = -1;
+        }
+        if (w->fd) ws_flush(w);
+    }
+    return 1;
+}
+
+#elif defined(_WIN32)
+    int ws_open(char *port) { return -1; }
+    int ws_tick(double t) { return 1; }
+#endif
+
+// ================================= GeoJSON snapshot =====================================
+//
+// The traffic picture as a GeoJSON FeatureCollection of Points, kept serialized per 1 degree tile.  A
+// change of a vessel marks the tiles of its old and new position, geo_refresh re-encodes only those in
+// one pass over vs_lon/vs_lat, and the collection is the concatenation of the tile blobs.
+
+#define GEO_NX 360
+#define GEO_NY 180
+#define GEO_DEG 600000  // tile size [1/10000 min]
+
+typedef struct { char *s;  int len, cap, dirty; } geo_tile;  // features, comma separated
+
+geo_tile geo[GEO_NX*GEO_NY];
+int geo_dirty[GEO_NX*GEO_NY], geo_ndirty;
+int geo_all = 1;                // every tile is to be encoded
+long long geo_tiles, geo_features;  // re-encoded
+
+int geo_tile_of(int lon, int lat)  // -1 outside -180..180, -90..90 (position not available)
+{
+    if (lon < -180*GEO_DEG || lon >= 180*GEO_DEG || lat < -90*GEO_DEG || lat >= 90*GEO_DEG) return -1;
+    return (lat + 90*GEO_DEG) / GEO_DEG * GEO_NX + (lon + 180*GEO_DEG) / GEO_DEG;
+}
+
+void geo_mark(int lon, int lat)
+{
+    int k = geo_tile_of(lon, lat);
+    if (k >= 0 && !geo[k].dirty) { geo[k].dirty = 1;  geo_dirty[geo_ndirty++] = k; }
+}
+
+int geo_refresh(void)  // re-encode the marked tiles, 0 if out of memory
+{
+    static char f[640];
+    if (!geo_ndirty && !geo_all) return 1;
+
+    if (geo_all) for(int k=0; k<GEO_NX*GEO_NY; k++) { geo[k].len = 0;  geo[k].dirty = 1; }
+    else for(int j=0; j<geo_ndirty; j++) geo[geo_dirty[j]].len = 0;
+
+    for(int i=0; i<vt_n; i++)
+    {
+        int k = geo_tile_of(vs_lon[i], vs_lat[i]);
+        if (k < 0 || !geo[k].dirty) continue;
+        geo_tile *g = &geo[k];
+
+        vessel *v = &vt[i];
+        char *o = f + sprintf(f, "%s{\"type\":\"Feature\",\"geometry\":{\"type\":\"Point\",\"coordinates\":[", g->len ? "," : "");
+        o = j_num(o, deg6(v->lon), 6);  *o++ = ',';  o = j_num(o, deg6(v->lat), 6);
+        o += sprintf(o, "]},\"properties\":");
+        o = json_vessel(o, v, v->known & ~VF_POS);  *o++ = '}';
+
+        if (g->len + (o-f) > g->cap) { g->cap = 2*g->cap + (o-f);  if (!(g->s = realloc(g->s, g->cap))) { g->cap = g->len = 0;  return 0; } }
+        memcpy(g->s + g->len, f, o-f);  g->len += o-f;
+        geo_features++;
+    }
+    if (geo_all) { for(int k=0; k<GEO_NX*GEO_NY; k++) geo[k].dirty = 0;  geo_tiles += GEO_NX*GEO_NY; }
+    else { for(int j=0; j<geo_ndirty; j++) geo[geo_dirty[j]].dirty = 0;  geo_tiles += geo_ndirty; }
+    geo_ndirty = geo_all = 0;
+    return 1;
+}
+
+// ================================= HTTP query API =====================================
+//
+// -H port : GET /vessels                            all vessels, fields as far as known
+//           GET /vessels?bbox=lon0,lat0,lon1,lat1   those positioned inside the box [deg]
+//           GET /track/<mmsi>                       positions still in the track ring, oldest first
+//           GET /geojson                            positioned vessels as a GeoJSON FeatureCollection
+//
+// Responses are kept in HC_N cached bodies.  A vessel report drops only the bodies it affects: a box
+// holding its old or new position, its track.  Polling an unchanged picture costs a send() of the
+// cached body.  Bodies are reference counted so a client keeps sending one that was rebuilt meanwhile.
+
+#define HTTP_CLIENTS 64
+#define HC_N         32
+
+typedef struct { int refs, len, cap;  char d[]; } http_body;
+
+typedef struct
+{
+    char key[96];                    // request target, "" = free
+    int lon0, lat0, lon1, lat1;      // box of the vessels listed, [1/10000 min]
+    int mmsi;                        // track of, 0 = a list
+    int geojson;
+    int valid;  long long used;
+    http_body *b;
+} http_entry;
+
+typedef struct
+{
+    int fd, nin;  char in[2048];
+    char hdr[256];  int nhdr, off;   // response header, bytes sent of header and body
+    http_body *b;                    // body being sent
+} http_client;
+
+int http_fd = -1;
+http_entry hc[HC_N];  int hc_valid;
+http_client hcl[HTTP_CLIENTS];
+long long http_hits, http_builds;
+
+void http_unref(http_body *b) { if (b && --b->refs == 0) free(b); }
+
+void http_changed(int mmsi, int lon0, int lat0, int lon1, int lat1)  // drop the responses the change affects
+{
+    geo_mark(lon0, lat0);  geo_mark(lon1, lat1);
+    for(int i=0; hc_valid && i<HC_N; i++)
+    {
+        http_entry *e = &hc[i];  if (!e->valid) continue;
+        if (e->mmsi ? e->mmsi == mmsi : (lon0 >= e->lon0 && lon0 <= e->lon1 && lat0 >= e->lat0 && lat0 <= e->lat1) ||
+                                        (lon1 >= e->lon0 && lon1 <= e->lon1 && lat1 >= e->lat0 && lat1 <= e->lat1))
+            { e->valid = 0;  hc_valid--; }
+    }
+}
+
+#if defined(__linux__) || defined(__APPLE__)
+
+int agg_listen(int port, int type);  // aggregator, below
+
+int http_open(char *port)
+{
+    if ((http_fd = agg_listen(atoi(port), SOCK_STREAM)) < 0) return -1;
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+http_body *http_build(http_entry *e)  // JSON body of the entry's request, rewritten in place unless a client is sending it
+{
+    static int idx[VT_MAX];
+    static tk_point *pt[TK_MAX];
+    http_body *b = e->b;
+    char *s = b ? b->d : NULL;
+    size_t n = 0;
+
+    if (b && b->refs > 1) { b->refs--;  b = NULL; }
+    e->b = NULL;
+
+#define HTTP_ROOM(k)  if (n + (k) > (b ? (size_t)b->cap : 0)) {                                                  \
+                          size_t c = 2*(b ? b->cap : 0) + (k);  http_body *r = realloc(b, sizeof(http_body) + c); \
+                          if (!r) { free(b);  return NULL; }                                                      \
+                          b = r;  b->cap = c; }                                                                   \
+                      s = b->d;
+
+    if (e->geojson)
+    {
+        if (!geo_refresh()) return NULL;
+        HTTP_ROOM(64);
+        n = sprintf(s, "{\"type\":\"FeatureCollection\",\"features\":[");
+        for(int k=0; k<GEO_NX*GEO_NY; k++)
+        {
+            if (!geo[k].len) continue;
+            HTTP_ROOM(geo[k].len + 3);
+            if (s[n-1] != '[') s[n++] = ',';
+            memcpy(s + n, geo[k].s, geo[k].len);  n += geo[k].len;
+        }
+        HTTP_ROOM(2);
+        s[n++] = ']';  s[n++] = '}';
+    }
+    else if (e->mmsi)
+    {
+        vessel *v = vessel_find(e->mmsi);
+        int np = v ? track_get(&v->trk, v->mmsi, pt, TK_MAX) : 0;
+        HTTP_ROOM(64 + 112*(size_t)np);
+        char *o = s;
+        *o++ = '{';  o = j_int(o, "mmsi", e->mmsi, 0);  o = j_key(o, "track");  *o++ = '[';
+        for(int k=np-1; k>=0; k--)
+        {
+            if (k < np-1) *o++ = ',';
+            *o++ = '{';  o = j_int(o, "t", (long long)(pt[k]->t*1000 + 0.5), 3);
+            o = j_int(o, "lon", deg6(pt[k]->lon), 6);  o = j_int(o, "lat", deg6(pt[k]->lat), 6);
+            o = j_int(o, "sog", pt[k]->sog, 1);  o = j_int(o, "cog", pt[k]->cog, 1);  *o++ = '}';
+        }
+        *o++ = ']';  *o++ = '}';
+        n = o - s;
+    }
+    else
+    {
+        int all = e->lon0 == VS_NONE, nv = all ? vt_n : vs_bbox(e->lon0, e->lat0, e->lon1, e->lat1, idx);
+        HTTP_ROOM(32);
+        n = sprintf(s, "{\"vessels\":[");
+        for(int k=0; k<nv; k++)
+        {
+            HTTP_ROOM(520);
+            if (k) s[n++] = ',';
+            vessel *v = &vt[all ? k : idx[k]];
+            n = json_vessel(s + n, v, v->known) - s;
+        }
+        HTTP_ROOM(2);
+        s[n++] = ']';  s[n++] = '}';
+    }
+
+    b->refs = 1;  b->len = n;
+    return b;
+}
+
+http_entry *http_lookup(char *target)  // cached response for the request target, NULL = 404
+{
+    http_entry r;  memset(&r, 0, sizeof(r));
+    double x0, y0, x1, y1;
+
+    if (!strcmp(target, "/vessels") || (r.geojson = !strcmp(target, "/geojson"))) { r.lon0 = r.lat0 = VS_NONE;  r.lon1 = r.lat1 = 0x7FFFFFFF; }
+    else if (sscanf(target, "/vessels?bbox=%lf,%lf,%lf,%lf", &x0, &y0, &x1, &y1) == 4)
+    {
+        r.lon0 = (int)floor(fmin(x0, x1)*600000);  r.lon1 = (int)ceil(fmax(x0, x1)*600000);
+        r.lat0 = (int)floor(fmin(y0, y1)*600000);  r.lat1 = (int)ceil(fmax(y0, y1)*600000);
+    }
+    else if (sscanf(target, "/track/%d", &r.mmsi) != 1 || r.mmsi <= 0) return NULL;
+    if (strlen(target) >= sizeof(r.key)) return NULL;
+    strcpy(r.key, target);
+
+    static long long clock;
+    http_entry *e = NULL, *lru = &hc[0];
+    for(int i=0; i<HC_N && !e; i++)
+        if (!strcmp(hc[i].key, r.key)) e = &hc[i];
+        else if (hc[i].used < lru->used) lru = &hc[i];
+
+    if (e && e->valid) { e->used = ++clock;  http_hits++;  return e; }
+    if (!e) { e = lru;  if (e->valid) hc_valid--;  http_unref(e->b);  *e = r; }
+
+    if (!(e->b = http_build(e))) { e->key[0] = 0;  e->valid = 0;  return NULL; }
+    e->valid = 1;  hc_valid++;  e->used = ++clock;  http_builds++;
+    return e;
+}
+
+void http_close(http_client *c) { close(c->fd);  http_unref(c->b);  memset(c, 0, sizeof(*c)); }
+
+void http_request(http_client *c)  // answer the first complete request in c->in
+{
+    c->in[c->nin] = 0;
+    char *end = strstr(c->in, "\r\n\r\n"), target[128] = "";
+    if (!end) { if (c->nin == sizeof(c->in)-1) http_close(c);  return; }
+
+    http_entry *e = NULL;
+    int get = sscanf(c->in, "GET %127s HTTP/1.%*d", target) == 1;
+    if (get) e = http_lookup(target);
+
+    if (e) { c->b = e->b;  c->b->refs++; }
+    c->nhdr = sprintf(c->hdr, "HTTP/1.1 %s\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\nContent-Length: %d\r\n\r\n",
+                      e ? "200 OK" : get ? "404 Not Found" : "405 Method Not Allowed", e ? e->b->len : 0);
+    c->off = 0;
+    end += 4;  c->nin -= end - c->in;  memmove(c->in, end, c->nin);
+}
+
+void http_flush(http_client *c)  // 0 when the response is sent
+{
+    while (c->nhdr)
+    {
+        int total = c->nhdr + (c->b ? c->b->len : 0), k;
+        if (c->off < c->nhdr) k = send(c->fd, c->hdr + c->off, c->nhdr - c->off, 0);
+        else k = send(c->fd, c->b->d + c->off - c->nhdr, total - c->off, 0);
+        if (k < 0 && errno != EAGAIN && errno != EWOULDBLOCK) { http_close(c);  return; }  // reset, gone
+        if (k <= 0) return;
+        if ((c->off += k) == total) { http_unref(c->b);  c->b = NULL;  c->nhdr = 0;  http_request(c); }  // next request, keep-alive
+    }
+}
+
+void http_poll(void)  // accept clients, answer requests, push responses
+{
+    int fd;
+    while ((fd = accept(http_fd, NULL, NULL)) >= 0)
+    {
+        int k = 0;  while (k < HTTP_CLIENTS && hcl[k].fd) k++;
+        if (k == HTTP_CLIENTS) { close(fd);  continue; }
+        int one = 1;  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // header and body go in separate sends
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        hcl[k].fd = fd;
+    }
+
+    for(int k=0; k<HTTP_CLIENTS; k++)
+    {
+        http_client *c = &hcl[k];  if (!c->fd) continue;
+
+        int room = sizeof(c->in)-1 - c->nin, n = room ? recv(c->fd, c->in + c->nin, room, 0) : -1;  // full: pipelined requests wait for the response
+        if (n == 0 || (n < 0 && room && errno != EAGAIN && errno != EWOULDBLOCK)) { http_close(c);  continue; }  // disconnected, reset
+        if (n > 0) { c->nin += n;  if (!c->nhdr) http_request(c); }
+        if (c->fd) http_flush(c);
+    }
+}
+
+#elif defined(_WIN32)
+    int http_open(char *port) { return -1; }
+    void http_poll(void) {}
+#endif
+
+// ================================= Output =====================================
+
+void output_AIS_message(AIS_msg *m)
+{
+    vessel *v = vessel_update(m);
+
+    if (tk_tol > 0 && v && m->id >= 1 && m->id <= 3 && !v->kept) return;  // simplified away
+
+    if (th_interval >= 0 && v)
+    {
+        if (!throttle_pass(v, m)) { th_dropped++;  return; }
+        th_passed++;
+    }
+
+    if (up_f) uplink_AIS_message(m, v);
+
+    if (out_json) json_AIS_message(m);
+    else if (out_nmea) nmea_AIS_message(m);
+    else print_AIS_message(m);
+}
+
+void output_tick(void)  // after each IQ buffer
+{
+    double now = clk_t0 + (double)clk_smp/RATE;
+    timer_run(now);
+    if (sp_n > SP_MAX/4*3 && (sp_n - sp_kept > SP_MAX/16 || now - sp_kept_t > VT_TTL)) vessel_compact_strings(now);  // texts added, or vessels expired since
+    if (up_f) uplink_flush();
+    if (http_fd >= 0) http_poll();
+    if (ws_fd >= 0 && !ws_tick(now)) return;  // changes pile up until the next WebSocket tick
+
+    for(int i=0; i<vt_ndirty; i++) { vessel *v = vessel_find(vt_dirty[i]);  if (v) v->dirty = 0; }
+    vt_ndirty = 0;
+}
+
+// ================================= Failed frame dumps =====================================
+//
+// -D file : windows of the envelope sA and discriminator sF where the amplitude gate of AIS_decode
+// fired but synchronisation or CRC failed, with the bytes recovered by HDLC.  Per record a dump_hdr,
+// int sA[n], int sF[n] and unsigned char msg[nmsg].  -R file replays the windows through AIS_decode.
+
+#define DUMP_PRE   50           // samples kept before the start of the amplitude gate
+#define DUMP_RATE  20           // records per second of signal, at most
+#define DUMP_MAX   (100<<20)    // bytes per file, at most
+
+typedef struct { char magic[4];  int reason, ch, rate, n, nmsg;  double t; } dump_hdr;  // reason: 1 sync, 2 CRC
+
+#define DUMP_SYNC 1
+#define DUMP_CRC  2
+
+FILE *dump_f;
+long long dump_bytes;
+double dump_tokens, dump_t;
+
+long long stat_gate, stat_nosync, stat_crc, stat_ok;  // amplitude gate fired, sync failed, CRC failed, decoded
+
+void dump_candidate(int reason, int ch, int rate, int *sA, int *sF, int from, int to, int n, unsigned char *msg, int nmsg)
+{
+    if (!dump_f) return;
+
+    double t = sample_time(from, rate);
+    dump_tokens += (t - dump_t) * DUMP_RATE;  dump_t = t;  // token bucket
+    if (dump_tokens > DUMP_RATE) dump_tokens = DUMP_RATE;
+    if (dump_tokens < 1) return;
+
+    from -= DUMP_PRE;  if (from < 0) from = 0;
+    if (to > n) to = n;
+    dump_hdr h = { {'E','S','F','D'}, reason, ch, rate, to - from, nmsg, t };
+    long long size = sizeof(h) + 2*sizeof(int)*h.n + nmsg;
+    if (dump_bytes + size > DUMP_MAX) return;
+
+    fwrite(&h, sizeof(h), 1, dump_f);
+    fwrite(&sA[from], sizeof(int), h.n, dump_f);
+    fwrite(&sF[from], sizeof(int), h.n, dump_f);
+    fwrite(msg, 1, nmsg, dump_f);
+    dump_bytes += size;  dump_tokens -= 1;
+}
+
+// ================================= HDLC, CRC =====================================
+
+unsigned short crc16(unsigned char *buff, int n)  // Frame Check Sequence, CRC-16-CCITT (0xFFFF)
+{
+    unsigned short crc = 0xFFFF;
+    for(int i=0; i<n; i++)
+    { unsigned char data = buff[i];  data ^= crc & 0xff;  data ^= data << 4;
+        crc = ((data<<8) | (crc>>8)) ^ (data>>4) ^ (data<<3); }
+    return ~crc;
+}
+
+#define PL 32  // HDLC synchronisation pattern legnth
+#define DEC_SPS 5  // samples per symbol at the decoder, made exact by the resampler
+#define MSG_MAX   64   // bytes of a frame kept: preamble and flag 4, message 5 has 53, FCS 2
+#define DEC_GUARD 128  // samples after the end of a decoder buffer, a strong sentinel for the amplitude gate
+
+int dec_track = 1;  // -P clears: slicing threshold follows the carrier offset through the burst (decision directed)
+void (*dec_emit)(AIS_msg *m) = output_AIS_message;  // where decoded frames go
+
+int sat_doppler;  // -L : satellite mode, [Hz] carrier offsets searched for each burst
+#define SAT_STEP 500  // [Hz] of the search
+
+int dec_tail(int rate) { return (20 + MSG_MAX*8*6/5 + 2) * rate / 9600; }  // samples a burst may need after its gate: sync search, longest stuffed frame
+
+void dec_guard(int *sA, int *sF, int n)  // n samples valid, the gate stops in the guard at the latest
+{
+    for(int i=n; i<n+DEC_GUARD; i++) { sA[i] = 1<<28;  sF[i] = 0; }
+}
+
+// With -Y the decoder takes the bursts of two antennas at once: sA[1], sF[1] point div_lag samples into the
+// buffers of the second one, so both index the same moment.  The discriminator outputs less their thresholds
+// are summed before the bit decisions.  Each of them carries |A|^2 of its branch, so with equal noise the sum
+// weighs the antennas by their SNR like maximum-ratio combining would.
+
+#define DIV_LAG 256  // [samples at the decoder] largest offset between the streams of the antennas
+
+int div_lag, div_aligned;  // second antenna behind the first, bursts it was measured on
+
+int dec_soft(int **sF, int *dc, int nb, int p)  // discriminator less threshold, all antennas
+{
+    int x = sF[0][p] - dc[0];
+    if (nb > 1) x += sF[1][p] - dc[1];
+    return x;
+}
+
+const int pattern[PL] = {  -1,-1,1,1,-1,-1,1,1,  -1,-1,1,1,-1,-1,1,1,  -1,-1,1,1,-1,-1,1,1,  -1,-1,-1,-1,-1,-1,-1,1  };  // NRZI
+//                          0 1 0 1 0 1 0 1      0 1 0 1 0 1 0 1      0 1 0 1 0 1 0 1      0 1 1 1 1 1 1 0  // preamble and 0x7E
+
+// Two-level sync: the fine search below tries every sample of a 20 symbol window, the thresholds of each
+// carrier candidate of -L and both polarisations.  A coarse stream of sums of SYNC_D discriminator samples,
+// built once for the whole buffer, is correlated with the pattern less its mean, where the threshold drops
+// out.  Its peak leaves the fine search a window of 3*SYNC_D samples.  It pays off with the carrier
+// candidates of -L; for the receiver alone the fine search is as fast, see bench_sync, so by default
+// the two-level search runs with -L only.
+
+#define SYNC_D DEC_SPS  // decimation of the coarse stream, a sum per symbol
+
+int dec_coarse = -1;  // -C : two-level sync search, 1 on, 0 off, -1 with -L only
+int *dec_sD;          // coarse stream of the buffer being decoded, NULL = fine search alone
+
+int dec_coarse_on(void) { return dec_coarse < 0 ? sat_doppler > 0 : dec_coarse; }
+
+void dec_coarse_stream(int *sD, int **sF, int nb, int i, int n)  // sD[q] sums the discriminators of all antennas over samples SYNC_D*q..+SYNC_D-1, from sample i
+{
+    for(int q=i/SYNC_D; q<n/SYNC_D; q++) { int s = 0;  for(int r=0; r<SYNC_D; r++) s += sF[0][SYNC_D*q+r];  sD[q] = s; }
+    if (nb > 1) for(int q=i/SYNC_D; q<n/SYNC_D; q++) for(int r=0; r<SYNC_D; r++) sD[q] += sF[1][SYNC_D*q+r];
+}
+
+void dec_coarse_sync(int i, int T, int *ip, int *in)  // starts of the fine windows for either polarisation, preamble and flag within 20 symbols
+{
+    static int pc[PL], o[PL], To;  // pattern less mean, tap offsets at T
+    long long smax = 0, smin = 0;
+    int j, q0 = (i + SYNC_D-1) / SYNC_D, qp = q0, qn = q0;
+
+    if (T != To)
+    {
+        int m = 0;  for(j=2; j<PL; j++) m += pattern[j];
+        for(j=2; j<PL; j++) { pc[j] = (PL-2)*pattern[j] - m;  o[j] = j*T / SYNC_D;  }
+        To = T;
+    }
+    for(int q=q0; q<q0+20*T/SYNC_D; q++)
+    {
+        long long s = 0;
+        for(j=2; j<PL; j++) s += pc[j] * dec_sD[q + o[j]];
+        if (s > smax) { smax = s;  qp = q; }
+        if (s < smin) { smin = s;  qn = q; }
+    }
+    *ip = SYNC_D*qp - SYNC_D < i ? i : SYNC_D*qp - SYNC_D;  // a sum may hold the first symbol late in its samples
+    *in = SYNC_D*qn - SYNC_D < i ? i : SYNC_D*qn - SYNC_D;
+}
+
+int dec_sync(int **sF, int *dc, int nb, int i, int kn, int T, int pol, int *imax)  // best correlation with preamble and flag starting within kn samples, 0 = none
+{
+    int j, smax = 0;
+
+    for(int k=0; k<kn; k++)  // find maximal correlation with pattern on interval <0,kn> (i.e. synchronisation)
+    {
+        int s=0;
+        for(j=2; j<PL; j++) { int s0 = pol * pattern[j] * dec_soft(sF, dc, nb, i+k+j*T);   if (s0 < 0) break;   s+=s0; }  // first symbols may be in the ramp
+        if (j==PL && s>smax) { smax=s; *imax=k; }
+    }
+    return pol * smax;
+}
+
+// -E : reflections off quay walls and hulls smear a symbol into its neighbours.  A short linear equalizer on the
+// soft symbols, taps a symbol apart, learns to undo it by LMS on the preamble and flag found by the sync, then
+// follows its own decisions through the frame.  Fixed point: inputs Q10 of the symbol amplitude, taps Q12.
+
+#define EQ_N 3  // taps, centre on the symbol decided: more of them learn the noise of 30 training symbols
+
+int dec_eq;  // -E
+
+void eq_in(int *x, int **sF, int *dc, int nb, int p, int T, int g)  // soft symbols around sample p, normalised by g
+{
+    for(int m=0; m<EQ_N; m++)
+    {
+        long long v = (long long)dec_soft(sF, dc, nb, p + (m - EQ_N/2)*T) * 1024 / g;
+        x[m] = v > 4096 ? 4096 : v < -4096 ? -4096 : v;
+    }
+}
+
+int eq_run(int *w, int *x, int d, int sh)  // output Q10, then LMS step 2^-sh towards d, d = 0 : towards the decision
+{
+    int y = 0, e;
+    for(int m=0; m<EQ_N; m++) y += w[m] * x[m];
+    y >>= 12;
+    e = (d ? d : y > 0 ? 1024 : -1024) - y;
+    for(int m=0; m<EQ_N; m++) w[m] += e * x[m] >> sh;
+    return y;
+}
+
+int div_align(int **sA, int **sF, int *dc, int i, int T)  // both antennas alone find the preamble: measure their offset, returns its change
+{
+    int i0 = 0, i1 = 0, *f1 = sF[1] - div_lag;
+    if (!dec_sync(sF, dc, 1, i, 20*T, T, 1, &i0)) return 0;
+    if (!dec_sync(&f1, &dc[1], 1, i+i0-DIV_LAG, 2*DIV_LAG, T, 1, &i1)) return 0;
+
+    int d = i1 - DIV_LAG - div_lag;  // change of the offset, for the rest of the buffer too
+    div_lag += d;  div_aligned++;
+    sA[1] += d;  sF[1] += d;
+    return d;
+}
+
+void dec_level(int *sA, int *sF, int i, int w, int *dc, int *a, long long *sa)  // threshold, symbol amplitude and |A|^2 sum over w samples from i
+{
+    long long s = 0, s1 = 0;
+    *sa = 0;
+    for(int j=0; j<w; j++) { s += sF[i+j];  *sa += sA[i+j]; }
+    *dc = s / w;
+    for(int j=0; j<w; j++) s1 += abs(sF[i+j] - *dc);
+    *a = s1 / w;
+}
+
+int dec_burst(int n, int rate, int **sA, int **sF, int nb, int i, int ch, int last, int *ok)  // burst gated at i; a failure is counted if last
+{
+    int u, j, k=0, b;
+    int smax=0, imax=0;
+    int T = rate / 9600;  // GMSK - 9600 Bd, the rate a multiple of it
+
+    int dc[2] = {0}, a[2] = {0};  // slicing threshold (carrier offset seen by the discriminator) and symbol amplitude around it
+    long long sa[2] = {0};  int w = 16*T;
+    if (dec_track || sat_doppler || nb > 1 || dec_eq)  // start from the mean of ramp-up and preamble: whole 0101 periods
+        for(b=0; b<nb; b++) dec_level(sA[b], sF[b], i+2*T, w, &dc[b], &a[b], &sa[b]);
+
+    if (nb > 1 && div_align(sA, sF, dc, i, T))  // antenna 2 moved under its threshold
+    {
+        dec_level(sA[1], sF[1], i+2*T, w, &dc[1], &a[1], &sa[1]);
+        if (dec_sD) dec_coarse_stream(dec_sD, sF, nb, i, n);  // the sums follow the new offset
+    }
+
+    int ip = i, in = i, kn = 20*T;  // fine search windows for either polarisation
+    if (dec_sD) { dec_coarse_sync(i, T, &ip, &in);  kn = 3*SYNC_D; }
+
+    smax = dec_sync(sF, dc, nb, ip, kn, T, 1, &imax);
+
+    for(int f=-sat_doppler; f<=sat_doppler && sat_doppler; f+=SAT_STEP)  // carrier search: the discriminator gives |A|^2 sin(2 PI f / rate)
+    {
+        int c[2], im = 0, s;
+        for(b=0; b<nb; b++) c[b] = (int)(sa[b]/w * sin(2*M_PI*f/rate));
+        if ((s = dec_sync(sF, c, nb, ip, kn, T, 1, &im)) > smax) { smax = s;  imax = im;  memcpy(dc, c, sizeof(dc)); }
+    }
+
+    if (smax==0) { smax = dec_sync(sF, dc, nb, in, kn, T, -1, &imax);  ip = in; }  // try opposite polarisation
+
+    if (smax==0)  // HDLC Synch not found
+    {
+        if (last) { stat_nosync++;  dump_candidate(DUMP_SYNC, ch, rate, sA[0], sF[0], i, i + (20+PL+1)*T, n, NULL, 0); }
+        return i + (sat_doppler ? 20 : 220)*T;  // colliding bursts: look for a preamble right after the window searched
+    }
+
+    int i0 = i;
+    i = ip + imax;  // move to the beginning of AIS frame
+
+    int eq[EQ_N] = {0}, xe[EQ_N], g = a[0] + (nb > 1 ? a[1] : 0);  // taps, soft symbols, their amplitude
+    if (dec_eq)  // train on the known symbols, a few passes
+    {
+        eq[EQ_N/2] = 4096;  if (g < 1) g = 1;
+        for(int r=0; r<4; r++) for(j=2; j<PL; j++) { eq_in(xe, sF, dc, nb, i+j*T, T, g);  eq_run(eq, xe, (smax > 0 ? 1024 : -1024) * pattern[j], 13); }
+    }
+
+    u = k = 0;
+    unsigned char msg[MSG_MAX] = {0};
+    unsigned char out, old_bit = 99, bit;
+    char o1,o2,o3,o4,o5;  o1=o2=o3=o4=o5=0;
+    long long level = 0;
+
+    for(j=0; ; j++)  // HDLC decoding, within dec_tail of the gate
+    {
+        int p = i+j*T, amp = sA[0][p] + (nb > 1 ? sA[1][p] : 0);
+        if (amp < nb*2*2) break;  // weak signal
+        level += amp;
+
+        int x = dec_soft(sF, dc, nb, p);
+        if (dec_eq) { eq_in(xe, sF, dc, nb, p, T, g);  x = eq_run(eq, xe, 0, 15); }
+        bit = (x > 0) ? 0 : 1;
+        if (dec_track) for(b=0; b<nb; b++)  // follow the decisions
+        { int xb = sF[b][p] - dc[b];
+            dc[b] += (xb - (bit ? -a[b] : a[b])) / 16;  a[b] += (abs(xb) - a[b]) / 16; }
+
+        out = (bit != old_bit) ? 0 : 1;  // NRZI decoding (change=0, no change=1)
+        old_bit = bit;
+
+        // bit-stuffing: if 6 consecutive one's then zero is inserted because of flag 0x7E distinguishing => skip zero
+        if (o1==1 && o2==1 && o3==1 && o4==1 && o5==1) { o1=o2=o3=o4=o5=0;  if (out==0) continue; }
+        o5=o4; o4=o3; o3=o2; o2=o1; o1=out;
+
+        if (out==1) msg[u] |= 1<<k;  // bits to byte (LSF)
+
+        if (++k == 8) { k=0;  if (++u == MSG_MAX-1) break; }
+    }
+
+    // CRC check :
+
+    int msgID = bits2int(&msg[4], 0, 6);
+    int msglen = (msgID == 5) ? 53 : 21;  // Message 5 is 424 bits long
+
+    int crc0 = *((unsigned short *)&msg[msglen+4]);
+    int crc  = crc16(&msg[4], msglen);
+
+    if (crc == crc0)
+    {
+        AIS_msg m;
+        parse_cached(&msg[4], msglen, crc, &m);
+        m.ch = ch;  m.t = sample_time(i, rate);
+        m.level = j ? level/j : 0;  m.corr = abs(smax)/PL;
+        m.p = &msg[4];  m.len = msglen;
+        dec_emit(&m);
+        stat_ok++;  *ok = 1;
+    }
+    else
+    {
+        if (last) { stat_crc++;  dump_candidate(DUMP_CRC, ch, rate, sA[0], sF[0], i0, i + j*T + T, n, msg, u < (int)sizeof(msg) ? u : (int)sizeof(msg)); }
+        if (sat_doppler) return i + PL*T;  // a stronger burst may start inside this one
+    }
+
+    return i + (j+1)*T;  // a symbol on at least: a sync found at the gate may stop at the first symbol, the gate steps a sample back
+}
+
+int AIS_decode(int n, int rate, int **sA, int **sF, int nb, int i, int ch)  // i < n - dec_tail(rate), sentinel by dec_guard; nb antennas
+{
+    int k = 0, ok = 0;
+
+    // find 100 consecutive samples with amplitude >= 4
+    if (nb > 1) for(;; i++) { if (sA[0][i] + sA[1][i] < 2*4*4) k=0;  else if (++k>=100) break; }
+    else        for(;; i++) { if (sA[0][i] < 4*4) k=0;  else if (++k>=100) break; }
+
+    i -= k;   if (i > n-dec_tail(rate)) return i;  // End of buffer, the burst waits for the next one
+    stat_gate++;
+
+    int r = dec_burst(n, rate, sA, sF, nb, i, ch, nb == 1, &ok);
+    if (nb > 1 && !ok)  // combining lost it, an antenna alone may still have it: first one decoding wins, so it is emitted once
+    {
+        int *sD = dec_sD;  dec_sD = NULL;  // the coarse stream holds the sum of both
+        for(int b=0; b<nb && !ok; b++) { int rb = dec_burst(n, rate, &sA[b], &sF[b], 1, i, ch, b == nb-1, &ok);  if (ok) r = rb; }
+        dec_sD = sD;
+    }
+    return r;
+}
+
+// ================================= Tuning, Filtering, Demodulation =====================================
+
+#define NIQ 300000  // 1 buf per second
+
+#define FL 31  // FIR coeffs multiplied by factor 2^20
+int h3[FL] = { 349525, 288373, 143167, 0, -69570, -54470, 0, 36711, 30962, 0, -22642, -19513, 0, 14571, 12587, 0, -9335, -7997, 0, 5785, 4877, 0, -3395, -2804, 0, 1878, 1532, 0, -1044, -891, 0 };  // 1/3 band
+int h8[FL] = { 131072, 127428, 116895, 100620, 80332, 58108, 36092, 16222, 0, -11660, -18487, -20817, -19463, -15544, -10278, -4797, 0, 3534, 5569, 6171, 5631, 4356, 2772, 1239, 0, -830, -1251, -1339, -1205, -951, -648 };  // 1/8 band (6.25 kHz)
+int h4[FL] = { 262144, 235456, 165315, 77011, 0, -44474, -51042, -29975, 0, 21545, 26145, 15933, 0, -11897, -14535, -8863, 0, 6530, 7875, 4723, 0, -3334, -3921, -2289, 0, 1534, 1769, 1025, 0, -728, -916 };  // 1/4 band (12.5 kHz), satellite mode
+
+// Every stage buffer is laid out as  [ history | block | guard ].  The history is the input a stage could not
+// use up in the previous block and is moved to the front, so the filters and the decoder see one continuous
+// stream and a burst may straddle two blocks.  The guard takes the reads and writes of the last, partly used
+// kernel pass, so the loops below run whole passes to the end of a block without looking at it.
+
+#define FB    256           // FIR outputs per kernel pass
+#define FH    (2*FL-2)      // history a FIR needs in front of its first output
+#define GUARD (3*FB + 2*FL) // covers the input of a whole last pass at decimation 3
+#define DCM 2  // works fine also with DCM 1, 3
+
+void fir_block(int *y, int *x, int m, int d, int h[])  // y[q] = FIR centred on x[d*q + FL-1], q < m rounded up to FB, d <= 3
+{
+    for(int q0=0; q0<m; q0+=FB, x+=d*FB, y+=FB)
+    {
+        int p[3][FB + FH + 1], a[FB];  // input split into its d phases: every tap is a unit stride vector loop, sized for d = 1
+        for(int r=0; r<d; r++) for(int j=0; j<=FB + FH/d; j++) p[r][j] = x[d*j + r];
+
+        for(int q=0; q<FB; q++) a[q] = h[0] * p[(FL-1)%d][q + (FL-1)/d];
+        for(int k=1; k<FL; k++)
+        {
+            int c = h[k], *u = &p[(FL-1-k)%d][(FL-1-k)/d], *v = &p[(FL-1+k)%d][(FL-1+k)/d];
+            if (c) for(int q=0; q<FB; q++) a[q] += c * (u[q] + v[q]);
+        }
+        for(int q=0; q<FB; q++) y[q] = a[q] >> 19;
+    }
+}
+
+// The decoder wants a whole number of samples per symbol: then a symbol is the same samples in every burst,
+// its loops step by T and the sampling phase found by the sync holds to the end of a frame.  After h8 the
+// stream is resampled to DEC_RATE by a polyphase windowed sinc.  The output time is kept as an input index
+// and a fraction acc/DEC_RATE, advanced by the input rate, so no error builds up over blocks.
+
+#define DEC_RATE (9600*DEC_SPS)  // [S/s] at the decoder
+#define RS_TAPS  8               // resampler taps per phase
+#define RS_PH    32              // phases between two input samples
+
+int resample(int *yI, int *yQ, int *xI, int *xQ, int n, int *p, int *acc)  // x: n samples after h8, y at DEC_RATE from x[*p] + *acc/DEC_RATE on; returns outputs
+{
+    static int h[RS_PH+1][RS_TAPS];  // 2^14 gain, row RS_PH is the next input sample
+    int o, M = RATE/3/DCM;
+    if (!h[0][RS_TAPS/2-1])
+        for(int r=0; r<=RS_PH; r++)
+        {
+            double w[RS_TAPS], s = 0;
+            for(int t=0; t<RS_TAPS; t++) { double u = t - (RS_TAPS/2-1) - (double)r/RS_PH;
+                w[t] = (u ? sin(M_PI*u)/(M_PI*u) : 1) * (0.54 + 0.46*cos(M_PI*u/(RS_TAPS/2)));  s += w[t]; }
+            for(int t=0; t<RS_TAPS; t++) h[r][t] = lround(16384 * w[t]/s);
+        }
+
+    int i = *p, a = *acc;
+    for(o=0; i + RS_TAPS/2 < n; o++)
+    {
+        int *c = h[(a*RS_PH + DEC_RATE/2) / DEC_RATE], *u = &xI[i - (RS_TAPS/2-1)], *v = &xQ[i - (RS_TAPS/2-1)], sI = 0, sQ = 0;
+        for(int t=0; t<RS_TAPS; t++) { sI += c[t]*u[t];  sQ += c[t]*v[t]; }
+        yI[o] = sI >> 14;  yQ[o] = sQ >> 14;
+        for(a += M; a >= DEC_RATE; a -= DEC_RATE) i++;
+    }
+    *p = i;  *acc = a;
+    return o;
+}
+
+// A carrier or spur inside a channel holds the amplitude gate open, and AIS_decode looks for a preamble every
+// 220 symbols.  Each block is cut into slices of 5 ms.  A slice is narrowband when it is at the gate level
+// and its correlation 16 symbols apart is above half its power: a GMSK burst is no longer coherent that far.
+// The bursts may cover most of a busy block, the gaps between them show the interferer: once NT_DECIDE slices
+// are gathered (short blocks of a live stream add theirs up), with a fifth of them narrowband at one frequency
+// the blocks are passed through a notch there before the discriminator, until the next decision.
+// The phase of the correlation at lag 1 gives the frequency roughly (the filtered noise pulls it to 0 Hz),
+// the phases at lags 8 and NT_LAG refine it within their ambiguity.  One interferer per channel.
+
+#define NT_SLICE (DEC_RATE/200) // samples of a slice
+#define NT_LAG   (16*DEC_SPS)   // lag of the narrowband test
+#define NT_R     16302          // pole radius 0.995 (2^14), about 75 Hz wide: the preamble has a line at the channel centre
+#define NT_DECIDE 100           // slices of a decision, 0.5 s
+#define NT_SLOTS  ((NIQ/6 + GUARD)/NT_SLICE + NT_DECIDE)
+
+int notch_on = 1;  // -N clears: narrowband interferers are notched
+
+typedef struct
+{
+    int on, c[2], rc[2], x1[2], y1[2], blocks;  double f;  // zero and pole e^jw, r e^jw (2^14), state; blocks notched, [Hz]
+    int ns, nn;  double p[NT_SLOTS], u[NT_SLOTS][3][2];    // slices since the decision, the narrowband ones: power and unit phasors at each lag
+} notch;
+
+void notch_block(notch *nt, int *I, int *Q, int n)  // I[1..n], Q[1..n] with the previous sample in front
+{
+    static const int lag[3] = { 1, 8, NT_LAG };
+    int nq = 0, l;
+    double cp[3] = {0}, sp[3] = {0}, pmin = 1e300;
+    for(int s0=NT_LAG+1; s0+NT_SLICE<=n+1; s0+=NT_SLICE, nt->ns++)
+    {
+        double p = 0, r[3] = {0}, q[3] = {0};
+        for(int i=s0; i<s0+NT_SLICE; i++) p += (double)I[i]*I[i] + (double)Q[i]*Q[i];
+        for(l=0; l<3; l++) for(int i=s0, d=lag[l]; i<s0+NT_SLICE; i++)  // x conj(x[-d])
+        { r[l] += (double)I[i]*I[i-d] + (double)Q[i]*Q[i-d];  q[l] += (double)Q[i]*I[i-d] - (double)I[i]*Q[i-d]; }
+
+        if (p < 16.0*NT_SLICE || r[2]*r[2] + q[2]*q[2] < 0.25*p*p) continue;
+        for(l=0; l<3; l++) { double a = sqrt(r[l]*r[l] + q[l]*q[l]);  nt->u[nt->nn][l][0] = r[l]/a;  nt->u[nt->nn][l][1] = q[l]/a; }
+        nt->p[nt->nn++] = p;
+    }
+
+    if (nt->ns >= NT_DECIDE)
+    {
+        for(int j=0; j<nt->nn; j++) pmin = fmin(pmin, nt->p[j]);
+        for(int j=0; j<nt->nn; j++) if (nt->p[j] < 2*pmin)  // the edge of a burst still passes the test but pulls the phase: the interferer alone
+        { for(l=0; l<3; l++) { cp[l] += nt->u[j][l][0];  sp[l] += nt->u[j][l][1]; }  nq++; }
+        int on = nt->nn >= nt->ns/5 && cp[2]*cp[2] + sp[2]*sp[2] >= 0.25*nq*nq;  // in the gaps between bursts, one frequency
+        double w = atan2(sp[0], cp[0]);
+        for(l=1; l<3; l++) { double wl = atan2(sp[l], cp[l]);  w = (wl + 2*M_PI*lround((w*lag[l] - wl) / (2*M_PI))) / lag[l]; }
+        if (on && (!nt->on || fabs(w - 2*M_PI*nt->f/DEC_RATE) > 2*M_PI*50/DEC_RATE))  // new or moved: start over
+        {
+            nt->c[0] = lround(16384*cos(w));  nt->c[1] = lround(16384*sin(w));
+            nt->rc[0] = nt->c[0]*NT_R >> 14;  nt->rc[1] = nt->c[1]*NT_R >> 14;
+            memset(nt->x1, 0, sizeof(nt->x1));  memset(nt->y1, 0, sizeof(nt->y1));
+            nt->f = w*DEC_RATE/(2*M_PI);
+        }
+        nt->on = on;  nt->ns = nt->nn = 0;
+    }
+    if (!nt->on || !notch_on) return;
+    nt->blocks++;
+
+    int xI = nt->x1[0], xQ = nt->x1[1], yI = nt->y1[0], yQ = nt->y1[1];  // y in 2^8: whole numbers leave the pole a dead band of 1/(1-r)
+    for(int i=1; i<=n; i++)  // y = x - c x[-1] + r c y[-1]
+    {
+        int uI = I[i], uQ = Q[i];
+        int vI = (uI << 8) - ((nt->c[0]*xI - nt->c[1]*xQ) >> 6) + (int)(((long long)nt->rc[0]*yI - (long long)nt->rc[1]*yQ) >> 14);
+        yQ     = (uQ << 8) - ((nt->c[0]*xQ + nt->c[1]*xI) >> 6) + (int)(((long long)nt->rc[0]*yQ + (long long)nt->rc[1]*yI) >> 14);
+        yI = vI;
+        I[i] = (yI + 128) >> 8;  Q[i] = (yQ + 128) >> 8;  xI = uI;  xQ = uQ;
+    }
+    nt->x1[0] = xI;  nt->x1[1] = xQ;  nt->y1[0] = yI;  nt->y1[1] = yQ;
+}
+
+typedef struct  // stage buffers of one antenna
+{
+    int RI[FH+12 + NIQ + GUARD], RQ[FH+12 + NIQ + GUARD], r1;                    // IQ at RATE
+    int AI[NIQ/3 + GUARD], AQ[NIQ/3 + GUARD];                                      // after h3
+    int CI[2][FH+2 + NIQ/3 + GUARD], CQ[2][FH+2 + NIQ/3 + GUARD], h2;             // channels 1 & 2, 100 kS/s
+    int DI[2][RS_TAPS + NIQ/6 + GUARD], DQ[2][RS_TAPS + NIQ/6 + GUARD], rs, acc; // after h8, resampler history and phase
+    int EI[2][1 + NIQ/6 + GUARD], EQ[2][1 + NIQ/6 + GUARD];                       // at DEC_RATE, previous sample in front
+    notch nt[2];                                                                   // of the channels
+    int SA[2][DIV_LAG + 4096 + NIQ/6 + GUARD], SF[2][DIV_LAG + 4096 + NIQ/6 + GUARD];  // amplitude, frequency for AIS_decode
+    double lag;  // [IQ samples] the decoder buffer starts this much before the IQ block, without the samples carried over
+} antenna;
+
+antenna ant[2];          // the second one with -Y
+unsigned char *div_iq;   // -Y : IQ block of the second antenna, as long as the one passed to proces_buff
+int dec_c[2];            // decoder samples carried over, per channel
+
+void spec_grab(unsigned char *buff, int n, int **cI, int **cQ, int m);  // Spectrum monitor, below
+
+int antenna_demod(antenna *d, int n, unsigned char *buff, int *c, double *t)  // IQ block after c[k] decoder samples carried over, returns decoder samples added
+{
+    int i, k, m1, m2, m3 = 0, p = 0, acc = 0;
+
+    for(i=0; i<n; i++) { d->RI[d->r1+i] = buff[2*i]   - 128;
+        d->RQ[d->r1+i] = buff[2*i+1] - 128; }
+
+    // originally intended for 100 kHz sampling rate, but RTL doesn't support it
+    m1 = d->r1+n > FH ? ((d->r1+n-FH)/3) & ~3 : 0;  // third-sampling with anti-aliasing, whole periods of the channel shift
+    fir_block(d->AI, d->RI, m1, 3, h3);
+    fir_block(d->AQ, d->RQ, m1, 3, h3);
+    *t = trace_mark("h3", *t);
+
+    int *AI = d->AI, *AQ = d->AQ, *I1 = &d->CI[0][d->h2], *Q1 = &d->CQ[0][d->h2], *I2 = &d->CI[1][d->h2], *Q2 = &d->CQ[1][d->h2];
+    for(i=0; i<m1; i+=4)  // split I/Q stream into AIS channels 1 & 2
+    {
+        I2[i+0] =  AI[i+0];  Q2[i+0] =  AQ[i+0];  // shift stream by 25 kHz (PI/2) to channel 2
+        I2[i+1] =  AQ[i+1];  Q2[i+1] = -AI[i+1];
+        I2[i+2] = -AI[i+2];  Q2[i+2] = -AQ[i+2];
+        I2[i+3] = -AQ[i+3];  Q2[i+3] =  AI[i+3];
+
+        I1[i+0] =  AI[i+0];  Q1[i+0] =  AQ[i+0];  // and by -25 kHz to channel 1
+        I1[i+1] = -AQ[i+1];  Q1[i+1] =  AI[i+1];
+        I1[i+2] = -AI[i+2];  Q1[i+2] = -AQ[i+2];
+        I1[i+3] =  AQ[i+3];  Q1[i+3] = -AI[i+3];
+    }
+    if (d == ant) { int *cI[2] = { I1, I2 }, *cQ[2] = { Q1, Q2 };  spec_grab(buff, n, cI, cQ, m1); }
+    *t = trace_mark("channel split", *t);
+
+    m2 = d->h2+m1 > FH ? (d->h2+m1-FH)/DCM : 0;  // half-sampling with low-pass 6.25 kHz
+    for(k=0; k<2; k++) { fir_block(&d->DI[k][d->rs], d->CI[k], m2, DCM, sat_doppler ? h4 : h8);  // Doppler shifted bursts need the wider one
+        fir_block(&d->DQ[k][d->rs], d->CQ[k], m2, DCM, sat_doppler ? h4 : h8); }
+    *t = trace_mark("h8", *t);
+
+    for(k=0; k<2; k++) { p = RS_TAPS/2-1;  acc = d->acc;  m3 = resample(&d->EI[k][1], &d->EQ[k][1], d->DI[k], d->DQ[k], d->rs + m2, &p, &acc); }
+    *t = trace_mark("resample", *t);
+
+    for(k=0; k<2; k++) notch_block(&d->nt[k], d->EI[k], d->EQ[k], m3);
+    *t = trace_mark("notch", *t);
+
+    for(k=0; k<2; k++)
+    {
+        int *I = d->EI[k], *Q = d->EQ[k], *sA = &d->SA[k][c[k]], *sF = &d->SF[k][c[k]];
+        for(i=0; i<((m3+15) & ~15); i++) {  sF[i] = Q[i+1]*I[i] - Q[i]*I[i+1];  // FM demodulation
+            sA[i] = I[i+1]*I[i+1] + Q[i+1]*Q[i+1]; }  // AM demodulation
+        I[0] = I[m3];  Q[0] = Q[m3];
+        dec_guard(d->SA[k], d->SF[k], c[k] + m3);
+    }
+    *t = trace_mark("demod", *t);
+
+    d->lag = 3*d->h2 + d->r1 - (FL-1)*(1+3)  // filters are centred FL-1 taps in, the resampler starts past its history
+           - 3*DCM*(RS_TAPS/2-1 + (double)d->acc/DEC_RATE - d->rs);
+    for(k=0; k<2; k++) { memmove(d->DI[k], &d->DI[k][p - (RS_TAPS/2-1)], (d->rs + m2 - p + RS_TAPS/2-1)*sizeof(int));
+        memmove(d->DQ[k], &d->DQ[k][p - (RS_TAPS/2-1)], (d->rs + m2 - p + RS_TAPS/2-1)*sizeof(int)); }
+    d->rs += m2 - p + RS_TAPS/2-1;  d->acc = acc;
+    d->r1 += n - 3*m1;  memmove(d->RI, &d->RI[3*m1], d->r1*sizeof(int));  memmove(d->RQ, &d->RQ[3*m1], d->r1*sizeof(int));
+    for(k=0; k<2; k++) { memmove(d->CI[k], &d->CI[k][DCM*m2], (d->h2+m1-DCM*m2)*sizeof(int));  memmove(d->CQ[k], &d->CQ[k][DCM*m2], (d->h2+m1-DCM*m2)*sizeof(int)); }
+    d->h2 += m1 - DCM*m2;
+    return m3;
+}
+
+void proces_buff(int n, unsigned char *buff)
+{
+    int i, k, rate = DEC_RATE, nb = div_iq ? 2 : 1, h = div_iq ? DIV_LAG : 0, *c = dec_c;  // h: decoded samples kept in front for the offset of the antennas
+    static int sD[(DIV_LAG + 4096 + NIQ/6 + GUARD) / SYNC_D];
+
+    if (clk_t0 == 0) clk_t0 = wall_time() - (double)n/RATE;  // buffer has just been received
+    double t = trace_now();
+
+    int m = antenna_demod(&ant[0], n, buff, c, &t);
+    if (nb > 1) antenna_demod(&ant[1], n, div_iq, c, &t);
+
+    for(k=0; k<2; k++)
+    {
+        int nd = c[k] + m, tail = dec_tail(rate) + h;
+        int *sA[2] = { ant[0].SA[k], &ant[1].SA[k][div_lag] }, *sF[2] = { ant[0].SF[k], &ant[1].SF[k][div_lag] };
+        clk_lag = ((double)RATE/rate*c[k] + ant[0].lag) / RATE;
+        if ((dec_sD = dec_coarse_on() ? sD : NULL)) dec_coarse_stream(sD, sF, nb, h, nd);
+        i = h;   while (i < nd-tail) i = AIS_decode(nd, rate, sA, sF, nb, i, k+1);  // Channel 1, 2
+        t = trace_mark(k ? "AIS_decode ch2" : "AIS_decode ch1", t);
+
+        i -= h;  c[k] = nd-i;
+        for(int b=0; b<nb; b++) { memmove(ant[b].SA[k], &ant[b].SA[k][i], c[k]*sizeof(int));  memmove(ant[b].SF[k], &ant[b].SF[k][i], c[k]*sizeof(int)); }
+    }
+
+    clk_smp += n;
+    output_tick();
+    fflush(stdout);
+    trace_mark("output", t);
+}
+
+// =========================================== Spectrum monitor ==========================================
+//
+// -F dst[,n] : every n seconds of the sample clock the power spectra of the input at RATE and of both channels
+// after the split at RATE/3, written as binary frames to host:port or a file, for looking at a remote site:
+// noise floor, interferers, the bursts, a waterfall from consecutive frames.  From each n-second mark the
+// decode path copies one second of signal out of the blocks passing by, however short they are, when the
+// monitor thread is idle; a set due while it is busy is skipped (with -r the decoder waits instead).  The
+// thread runs at the lowest priority and averages Hann windowed FFTs over that second (Welch, no overlap).
+//
+//   frame   0xE6, source (0 = input, 1 = channel A, 2 = channel B), varint time [ms UTC], varint rate [S/s],
+//           varint bins, zigzag ref, zigzag floor, varint peak bin, zigzag peak, zigzag power, one byte per bin
+//
+// Levels are in 1/10 dB to a full scale carrier of the 8-bit input: floor is the median bin, peak the highest
+// bin, power the whole band.  Bin byte b is ref + 5*b, bins run from -rate/2 up, the channels are centred on
+// 161.975 and 162.025 MHz.
+
+#define SPEC_N  1024  // FFT of the input, 293 Hz bins
+#define SPEC_NC 512   // of a channel, 195 Hz bins
+
+typedef struct { double floor, peak, f, power; } spec_metrics;  // [dB], [dB] at f [Hz], [dB]
+
+FILE *spec_f;
+int spec_every;                     // -F : seconds between spectra
+int spec_wait;                      // a recording is not real time: the decode path waits for the monitor
+long long spec_sets, spec_skipped;  // spectra written, due while the monitor was busy
+spec_metrics spec_last[3];          // input, channels A and B
+
+#if defined(__linux__) || defined(__APPLE__)
+
+unsigned char *spec_iq;  int *spec_c[4], spec_n, spec_m;  double spec_t;  // the second being collected or handed over
+long long spec_next;  int spec_coll;  // sample clock of the next set, collecting
+atomic_int spec_full;
+pthread_mutex_t spec_mx = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t spec_cv = PTHREAD_COND_INITIALIZER;
+
+void fft(float *re, float *im, int n)  // in place, n a power of 2 up to SPEC_N
+{
+    static float wr[SPEC_N/2], wi[SPEC_N/2];
+    if (wr[0] == 0) for(int k=0; k<SPEC_N/2; k++) { wr[k] = cos(2*M_PI*k/SPEC_N);  wi[k] = -sin(2*M_PI*k/SPEC_N); }
+
+    for(int i=1, j=0; i<n; i++)  // bit reversed order
+    {
+        int b = n >> 1;
+        for(; j & b; b >>= 1) j ^= b;
+        if ((j |= b) > i) { float t = re[i];  re[i] = re[j];  re[j] = t;  t = im[i];  im[i] = im[j];  im[j] = t; }
+    }
+    for(int l=2; l<=n; l<<=1) for(int i=0; i<n; i+=l) for(int k=0; k<l/2; k++)
+    {
+        int p = i+k, q = p + l/2, s = k*(SPEC_N/l);
+        float xr = re[q]*wr[s] - im[q]*wi[s], xi = re[q]*wi[s] + im[q]*wr[s];
+        re[q] = re[p] - xr;  im[q] = im[p] - xi;  re[p] += xr;  im[p] += xi;
+    }
+}
+
+int cmp_double(const void *a, const void *b) { double x = *(const double *)a, y = *(const double *)b;  return (x > y) - (x < y); }
+
+void spec_frame(spec_metrics *e, int src, int rate, int n, double fs, unsigned char *b, int *xI, int *xQ, int len)  // fs: full scale amplitude; b 8-bit IQ or xI, xQ
+{
+    static float re[SPEC_N], im[SPEC_N], w[SPEC_N];
+    static double P[SPEC_N], d[SPEC_N], srt[SPEC_N];
+    static unsigned char fr[32 + SPEC_N];
+    int ns = len / n, pk = 0;
+    double sw = 0, sum = 0;
+    if (ns == 0) return;  // the stream ended right after the mark
+
+    for(int i=0; i<n; i++) { w[i] = 0.5 - 0.5*cos(2*M_PI*i/n);  sw += w[i]*w[i]; }
+    memset(P, 0, sizeof(P));
+    for(int s=0; s<ns; s++)
+    {
+        for(int i=0, j=s*n; i<n; i++, j++)
+            if (b) { re[i] = w[i]*(b[2*j] - 127.5);  im[i] = w[i]*(b[2*j+1] - 127.5); }
+            else   { re[i] = w[i]*xI[j];  im[i] = w[i]*xQ[j]; }
+        fft(re, im, n);
+        for(int k=0; k<n; k++) P[(k + n/2) % n] += (double)re[k]*re[k] + (double)im[k]*im[k];  // from -rate/2 up
+    }
+    for(int k=0; k<n; k++)  // a carrier at full scale is 0 dB in its bin: |X| = fs n/2 through the window
+    {
+        sum += P[k];
+        srt[k] = d[k] = 10*log10(P[k] / (ns * fs*fs * n*n/4) + 1e-30);
+        if (d[k] > d[pk]) pk = k;
+    }
+    qsort(srt, n, sizeof(double), cmp_double);
+    e->floor = srt[n/2];  e->peak = d[pk];  e->f = (double)(pk - n/2) * rate / n;
+    e->power = 10*log10(sum / (ns * n * sw * fs*fs) + 1e-30);
+
+    int ref = floor(10*fmax(srt[0], e->floor - 40));  // deep nulls are clipped to 40 dB below the floor
+    unsigned char *o = fr;
+    *o++ = 0xE6;  *o++ = src;  o = put_var(o, llround(spec_t*1e3));  o = put_var(o, rate);  o = put_var(o, n);
+    o = put_zz(o, ref);  o = put_zz(o, lround(10*e->floor));  o = put_var(o, pk);  o = put_zz(o, lround(10*e->peak));  o = put_zz(o, lround(10*e->power));
+    for(int k=0; k<n; k++) { long v = lround((10*d[k] - ref) / 5);  *o++ = v < 0 ? 0 : v > 255 ? 255 : v; }
+    if (spec_f) fwrite(fr, 1, o-fr, spec_f);
+}
+
+void spec_compute(void)  // frames of the block handed over
+{
+    double g3 = h3[0];  for(int k=1; k<FL; k++) g3 += 2*h3[k];  // in-band gain of h3, 2^19 per unit after fir_block
+    spec_frame(&spec_last[0], 0, RATE, SPEC_N, 128, spec_iq, NULL, NULL, spec_n);
+    for(int k=0; k<2; k++) spec_frame(&spec_last[1+k], 1+k, RATE/3, SPEC_NC, 128*g3/(1<<19), NULL, spec_c[2*k], spec_c[2*k+1], spec_m);
+    if (spec_f) fflush(spec_f);
+    spec_sets++;
+}
+
+void *spec_worker(void *a)
+{
+#if defined(__linux__)
+    setpriority(PRIO_PROCESS, 0, 19);  // this thread only
+#else
+    pthread_set_qos_class_self_np(QOS_CLASS_BACKGROUND, 0);
+#endif
+    for(;;)
+    {
+        pthread_mutex_lock(&spec_mx);
+        while (!atomic_load(&spec_full)) pthread_cond_wait(&spec_cv, &spec_mx);
+        pthread_mutex_unlock(&spec_mx);
+        spec_compute();
+        atomic_store(&spec_full, 0);
+    }
+    return NULL;
+}
+
+void spec_grab(unsigned char *buff, int n, int **cI, int **cQ, int m)  // block after the channel split, m samples of each channel
+{
+    if (!spec_every) return;
+    if (!spec_coll)
+    {
+        if (clk_smp < spec_next) return;
+        spec_next = (clk_smp / ((long long)spec_every*RATE) + 1) * spec_every*RATE;
+        if (atomic_load(&spec_full) && !spec_wait) { spec_skipped++;  return; }
+        while (atomic_load(&spec_full)) nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+        spec_coll = 1;  spec_n = spec_m = 0;  spec_t = clk_t0 + (double)clk_smp/RATE;
+    }
+
+    int a = n < RATE - spec_n ? n : RATE - spec_n, b = m < RATE/3 - spec_m ? m : RATE/3 - spec_m;
+    memcpy(&spec_iq[2*spec_n], buff, 2*a);  spec_n += a;
+    for(int k=0; k<2; k++) { memcpy(&spec_c[2*k][spec_m], cI[k], b*sizeof(int));  memcpy(&spec_c[2*k+1][spec_m], cQ[k], b*sizeof(int)); }
+    spec_m += b;
+    if (spec_n < RATE) return;
+
+    spec_coll = 0;
+    pthread_mutex_lock(&spec_mx);
+    atomic_store(&spec_full, 1);  pthread_cond_signal(&spec_cv);
+    pthread_mutex_unlock(&spec_mx);
+}
+
+void spec_drain(void) { while (spec_every && atomic_load(&spec_full)) nanosleep(&(struct timespec){ 0, 1000000 }, NULL); }  // the last spectra out before exit
+
+int spec_alloc(void)
+{
+    if (!spec_iq && !(spec_iq = malloc(2*RATE))) return 1;
+    for(int k=0; k<4; k++) if (!spec_c[k] && !(spec_c[k] = malloc(RATE/3*sizeof(int)))) return 1;
+    return 0;
+}
+
+int spec_open(char *arg)  // dst[,n]
+{
+    char *c = strrchr(arg, ',');
+    spec_every = c ? atoi(c+1) : 1;  if (c) *c = 0;
+    if (spec_every < 1) spec_every = 1;
+    pthread_t th;
+    return !(spec_f = dst_open(arg)) || spec_alloc() || pthread_create(&th, NULL, spec_worker, NULL);
+}
+
+#else
+    void spec_grab(unsigned char *buff, int n, int **cI, int **cQ, int m) {}
+    int spec_open(char *arg) { return 1; }
+    void spec_drain(void) {}
+#endif
+
+// =========================================== Replay of failed frames ==========================================
+
+int dump_replay(char *file)  // -R file : run the windows recorded by -D through AIS_decode again
+{
+    static int sA[16384], sF[16384], sD[16384/SYNC_D];
+    static unsigned char msg[256];
+    int nrec = 0, nsync = 0, nrate = 0;
+    dump_hdr h;
+
+    FILE *f = fopen(file, "rb");  if (!f) return 1;
+    print_table_header();
+
+    while (fread(&h, sizeof(h), 1, f) == 1 && !memcmp(h.magic, "ESFD", 4) && h.n > 0 && h.rate > 0 && h.rate <= 100000 && h.n <= 8192 && h.nmsg <= 256)
+    {
+        if (fread(sA, sizeof(int), h.n, f) != h.n || fread(sF, sizeof(int), h.n, f) != h.n || fread(msg, 1, h.nmsg, f) != h.nmsg) break;
+        if (h.rate % 9600) { nrate++;  continue; }  // recorded before the resampler, symbols fall between samples
+        int tail = dec_tail(h.rate), i = 0, n = h.n + tail;  // AIS_decode leaves the last tail samples to the next buffer
+        memset(&sA[h.n], 0, tail*sizeof(int));
+        memset(&sF[h.n], 0, tail*sizeof(int));
+        dec_guard(sA, sF, n);
+
+        clk_t0 = h.t - (double)DUMP_PRE/h.rate;  clk_smp = 0;  clk_lag = 0;
+        int *pA = sA, *pF = sF;
+        if ((dec_sD = dec_coarse_on() ? sD : NULL)) dec_coarse_stream(sD, &pF, 1, 0, n);
+        while (i < n-tail) i = AIS_decode(n, h.rate, &pA, &pF, 1, i, h.ch);
+
+        nrec++;  nsync += h.reason == DUMP_SYNC;
+    }
+    fclose(f);
+
+    fprintf(info_out(), "\n %d windows (sync failed %d, CRC failed %d), decoded now %lld \n", nrec, nsync, nrec - nsync, stat_ok);
+    if (nrate) fprintf(info_out(), " %d windows at a rate that is not a multiple of 9600 skipped\n", nrate);
+    return 0;
+}
+
+// =========================================== Replay of uplink captures ==========================================
+
+int uplink_replay(char *file)  // -X file : decode a stream written by -U
+{
+    static up_dec d;
+    static unsigned char b[65536];
+    int n;
+
+    FILE *f = fopen(file, "rb");  if (!f) return 1;
+    print_table_header();
+    d.emit = output_AIS_message;
+    while ((n = fread(b, 1, sizeof(b), f)) > 0) if (uplink_feed(&d, b, n)) { fclose(f);  return 2; }
+    fclose(f);
+    return 0;
+}
+
+// =========================================== Aggregator ==========================================
+//
+// -A port[,threads] : instead of a receiver, take the feeds of other stations on TCP and UDP port and
+// merge them into one stream.  A TCP connection carries either NMEA !AIVDM sentences (optionally with a
+// \c:time\ tag block) or the binary uplink of -U, recognised by its first byte; UDP datagrams carry NMEA.
+//
+// The I/O thread reassembles sentences and decodes uplink batches, then hands each frame to the shard
+// of its MMSI.  Shard threads de-armour the payload, drop copies of a transmission heard by several
+// stations (same frame within AGG_WINDOW) and parse it; message 5 interns its strings into the pool of
+// the main thread and is parsed there.  Their output passes through a heap which releases frames in
+// time order AGG_DELAY after their reception, into output_AIS_message and the vessel table as with the
+// receiver.  The vessel table has one writer, so its updates and the printers stay on the main thread.
+// Payloads up to 56 bytes (message 5 and shorter) are taken, like the decoder does.
+
+long long agg_in, agg_dups, agg_bad, agg_late;  // frames in, dropped as copies, malformed, released after a later one
+
+#if defined(__linux__) || defined(__APPLE__)
+
+#define AGG_SHARDS 16
+#define AGG_CONN   512        // TCP stations
+#define AGG_RING   2048       // frames queued to and from a shard
+#define AGG_SEEN   (1<<16)    // dedup entries per shard
+#define AGG_HEAP   (1<<16)    // frames waiting for reordering
+#define AGG_DATA   80         // armoured characters, 56 payload bytes
+#define AGG_WINDOW 10.0       // [s] same frame is a duplicate
+#define AGG_DELAY  2.0        // [s] reordering delay
+
+typedef struct { double t;  int ch, len, fill, nmea, parsed;  unsigned char d[AGG_DATA];  AIS_msg m; } agg_item;  // armoured text (nmea) or payload, m if parsed
+
+typedef struct { agg_item *q;  _Alignas(64) atomic_uint head;  _Alignas(64) atomic_uint tail; } agg_ring;  // one producer, one consumer
+
+typedef struct { unsigned long long key;  double t; } agg_seen;  // frame hash, reception time
+
+typedef struct
+{
+    agg_ring in, out;
+    agg_seen *seen;
+    long long dups, bad;
+    pthread_t th;
+} agg_shard;
+
+typedef struct
+{
+    int fd, kind;                         // kind 0 = not known yet, 1 = NMEA, 2 = binary uplink
+    int nl;  char ln[512];                // line being received
+    int mp_cnt, mp_next, mp_seq, mp_n;  char mp[AGG_DATA];  // multipart sentence being assembled
+    up_dec *d;
+} agg_conn;
+
+agg_shard agg_sh[AGG_SHARDS];  int agg_nsh;
+agg_conn  agg_c[AGG_CONN], agg_udp;  int agg_nc;
+agg_item *agg_heap;  int agg_hn;
+atomic_int agg_stop;
+double agg_last;  // time of the last frame released
+
+int ring_put(agg_ring *r, agg_item *it)
+{
+    unsigned h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (h - atomic_load_explicit(&r->tail, memory_order_acquire) == AGG_RING) return 0;
+    r->q[h % AGG_RING] = *it;
+    atomic_store_explicit(&r->head, h+1, memory_order_release);
+    return 1;
+}
+
+int ring_get(agg_ring *r, agg_item *it)
+{
+    unsigned t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    if (atomic_load_explicit(&r->head, memory_order_acquire) == t) return 0;
+    *it = r->q[t % AGG_RING];
+    atomic_store_explicit(&r->tail, t+1, memory_order_release);
+    return 1;
+}
+
+void agg_nap(void) { nanosleep(&(struct timespec){ 0, 100000 }, NULL); }
+
+int dearmor(unsigned char *p, unsigned char *s, int n, int fill)  // 6-bit ASCII to payload bytes, -1 if invalid
+{
+    int bits = n*6 - fill;
+    if (fill < 0 || fill > 5 || bits <= 0 || bits > 56*8) return -1;
+    memset(p, 0, (bits+7)/8);
+    for(int i=0; i<n; i++)
+    {
+        int v = s[i] - 48;  if (v > 40) v -= 8;
+        if (v < 0 || v > 63) return -1;
+        int2bits(p, 6*i, 6, v);
+    }
+    if (bits % 8) p[bits/8] &= 0xFF << (8 - bits%8);
+    return (bits+7)/8;
+}
+
+unsigned long long agg_key(unsigned char *p, int len)  // hash of the bits -U keeps, so NMEA and binary copies match
+{
+    unsigned char b[56];  memcpy(b, p, len);
+    int id = b[0] >> 2, end = len*8;
+    b[0] &= 0xFC;  // repeat indicator
+    if (id >= 1 && id <= 3) end = 143;
+    if (id == 4) end = 134;
+    if (id == 5) { end = 422;  b[4] &= 0xFC; }  // AIS version
+    if (end > len*8) end = len*8;
+    if (end % 8) b[end/8] &= 0xFF << (8 - end%8);
+
+    unsigned long long h = 14695981039346656037ULL;
+    for(int i=0; i<(end+7)/8; i++) h = (h ^ b[i]) * 1099511628211ULL;
+    return h;
+}
+
+void *agg_worker(void *a)  // de-armour, drop duplicates, parse
+{
+    agg_shard *s = a;
+    agg_item it;
+    unsigned char p[56];
+
+    while (!atomic_load(&agg_stop))
+    {
+        if (!ring_get(&s->in, &it)) { agg_nap();  continue; }
+        if (it.nmea)
+        {
+            if ((it.len = dearmor(p, it.d, it.len, it.fill)) < 5) { s->bad++;  continue; }
+            memcpy(it.d, p, it.len);  it.nmea = 0;
+        }
+        unsigned long long k = agg_key(it.d, it.len);
+        agg_seen *e = &s->seen[k & (AGG_SEEN-1)];
+        if (e->key == k && fabs(it.t - e->t) < AGG_WINDOW) { s->dups++;  continue; }
+        e->key = k;  e->t = it.t;
+        if ((it.parsed = it.d[0] >> 2 != 5)) { memset(&it.m, 0, sizeof(it.m));  parse_AIS_message(it.d, &it.m); }  // 5 interns strings
+        while (!ring_put(&s->out, &it)) { if (atomic_load(&agg_stop)) return NULL;  agg_nap(); }
+    }
+    return NULL;
+}
+
+void agg_output(agg_item *it)
+{
+    AIS_msg m;
+    if (it->parsed) m = it->m;
+    else { memset(&m, 0, sizeof(m));  parse_cached(it->d, it->len, crc16(it->d, it->len), &m); }
+    m.t = it->t;  m.ch = it->ch;  m.level = m.corr = 0;
+    m.p = it->d;  m.len = it->len;
+    if (m.t < agg_last) agg_late++;  else agg_last = m.t;
+    output_AIS_message(&m);
+}
+
+void agg_pop(agg_item *o)  // earliest frame of the heap
+{
+    *o = agg_heap[0];
+    agg_item x = agg_heap[--agg_hn];
+    int i = 0, c;
+    while ((c = 2*i+1) < agg_hn)
+    {
+        if (c+1 < agg_hn && agg_heap[c+1].t < agg_heap[c].t) c++;
+        if (x.t <= agg_heap[c].t) break;
+        agg_heap[i] = agg_heap[c];  i = c;
+    }
+    agg_heap[i] = x;
+}
+
+void agg_drain(void)  // shard output into the heap
+{
+    agg_item it;
+    double now = wall_time();
+
+    for(int k=0; k<agg_nsh; k++)
+        while (ring_get(&agg_sh[k].out, &it))
+        {
+            if (it.t > now + AGG_WINDOW) it.t = now;  // station clock ahead
+            if (agg_hn == AGG_HEAP) { agg_item o;  agg_pop(&o);  agg_output(&o); }
+            int i = agg_hn++;
+            while (i && agg_heap[(i-1)/2].t > it.t) { agg_heap[i] = agg_heap[(i-1)/2];  i = (i-1)/2; }
+            agg_heap[i] = it;
+        }
+}
+
+void agg_release(double now)  // frames older than the reordering delay, in time order
+{
+    agg_item it;
+    while (agg_hn && agg_heap[0].t <= now - AGG_DELAY) { agg_pop(&it);  agg_output(&it); }
+}
+
+void agg_push(agg_item *it, unsigned mmsi)
+{
+    agg_shard *s = &agg_sh[mmsi % agg_nsh];
+    agg_in++;
+    while (!ring_put(&s->in, it)) { agg_drain();  agg_nap(); }
+}
+
+void agg_emit(AIS_msg *m)  // frame of a binary uplink
+{
+    if (m->len < 21) { agg_bad++;  return; }  // shorter than message 1, the decoder sends none
+    agg_item it;
+    it.t = m->t;  it.ch = m->ch;  it.len = m->len;  it.fill = it.nmea = 0;
+    memcpy(it.d, m->p, m->len);
+    agg_push(&it, m->mmsi);
+}
+
+void agg_text(char *s, int n, int fill, int ch, double t)  // armoured payload of a complete sentence
+{
+    if (n < 7 || n > AGG_DATA) { agg_bad++;  return; }
+    agg_item it;
+    it.t = t;  it.ch = ch;  it.len = n;  it.fill = fill;  it.nmea = 1;
+    memcpy(it.d, s, n);
+
+    unsigned long long v = 0;  // MMSI from the first 7 characters, bits 8..37
+    for(int i=0; i<7; i++) { int c = s[i] - 48;  if (c > 40) c -= 8;  v = v << 6 | (c & 63); }
+    agg_push(&it, (v >> 4) & 0x3FFFFFFF);
+}
+
+void agg_sentence(agg_conn *c, char *s, double t)
+{
+    if (*s == '\\')  // tag block, c: is the reception time
+    {
+        char *e = strchr(s+1, '\\'), *k = strstr(s, "c:");
+        if (!e) return;
+        if (k && k < e) { double v = atof(k+2);  if (v > 1e11) v /= 1000;  if (v > 1e9) t = v; }
+        s = e+1;
+    }
+    if (*s != '!') return;
+
+    char *star = strchr(s, '*');
+    if (!star) { agg_bad++;  return; }
+    unsigned x = 0;
+    for(char *q=s+1; q<star; q++) x ^= (unsigned char)*q;
+    if (x != strtoul(star+1, NULL, 16)) { agg_bad++;  return; }
+    *star = 0;
+
+    char *f[7], *q = s;  int nf = 0;
+    while (q && nf < 7) { f[nf++] = q;  if ((q = strchr(q, ','))) *q++ = 0; }
+    if (nf < 7 || strlen(f[0]) != 6 || (strcmp(f[0]+3, "VDM") && strcmp(f[0]+3, "VDO"))) { agg_bad++;  return; }
+
+    int cnt = atoi(f[1]), num = atoi(f[2]), seq = atoi(f[3]), fill = atoi(f[6]), n = strlen(f[5]);
+    int ch = f[4][0] == 'B' || f[4][0] == '2' ? 2 : 1;
+    if (cnt <= 1) { agg_text(f[5], n, fill, ch, t);  return; }
+
+    if (num == 1) { c->mp_cnt = cnt;  c->mp_seq = seq;  c->mp_n = 0; }
+    else if (num != c->mp_next || cnt != c->mp_cnt || seq != c->mp_seq) { c->mp_next = 0;  return; }
+    if (c->mp_n + n > AGG_DATA) { c->mp_next = 0;  agg_bad++;  return; }
+    memcpy(c->mp + c->mp_n, f[5], n);  c->mp_n += n;  c->mp_next = num+1;
+    if (num == cnt) { agg_text(c->mp, c->mp_n, fill, ch, t);  c->mp_next = 0; }
+}
+
+int agg_input(agg_conn *c, unsigned char *b, int n, double t)  // -1 closes the connection
+{
+    if (!c->kind) c->kind = b[0] == 0xE5 ? 2 : 1;
+    if (c->kind == 2)
+    {
+        if (!c->d) { if (!(c->d = calloc(1, sizeof(up_dec)))) return -1;  c->d->emit = agg_emit; }
+        return uplink_feed(c->d, b, n);
+    }
+    for(int i=0; i<n; i++)
+        if (b[i] == '\n' || b[i] == '\r')
+        {
+            if (c->nl && c->nl < (int)sizeof(c->ln)) { c->ln[c->nl] = 0;  agg_sentence(c, c->ln, t); }
+            c->nl = 0;
+        }
+        else if (c->nl < (int)sizeof(c->ln)-1) c->ln[c->nl++] = b[i];
+        else c->nl = sizeof(c->ln);  // too long, dropped
+    return 0;
+}
+
+int agg_listen(int port, int type)
+{
+    struct sockaddr_in a;  memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;  a.sin_port = htons(port);  a.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int fd = socket(AF_INET, type, 0), one = 1;
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&a, sizeof(a)) < 0 || (type == SOCK_STREAM && listen(fd, 64) < 0)) { close(fd);  return -1; }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+void agg_sigint(int sig) { atomic_store(&agg_stop, 1); }
+
+int aggregate(char *arg)
+{
+    int port = 0, n;
+    agg_nsh = 2;
+    sscanf(arg, "%d,%d", &port, &agg_nsh);
+    if (agg_nsh < 1) agg_nsh = 1;
+    if (agg_nsh > AGG_SHARDS) agg_nsh = AGG_SHARDS;
+
+    int tcp = agg_listen(port, SOCK_STREAM), udp = agg_listen(port, SOCK_DGRAM);
+    if (tcp < 0 || udp < 0) return 5;
+    if (!(agg_heap = malloc(AGG_HEAP * sizeof(agg_item)))) return 6;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, agg_sigint);
+
+    for(int k=0; k<agg_nsh; k++)
+    {
+        agg_shard *s = &agg_sh[k];
+        s->in.q = malloc(AGG_RING * sizeof(agg_item));  s->out.q = malloc(AGG_RING * sizeof(agg_item));
+        s->seen = calloc(AGG_SEEN, sizeof(*s->seen));
+        if (!s->in.q || !s->out.q || !s->seen || pthread_create(&s->th, NULL, agg_worker, s)) return 6;
+    }
+    agg_udp.fd = udp;  agg_udp.kind = 1;
+
+    fprintf(info_out(), "\n === aggregating stations on TCP/UDP port %d, %d threads === \n\n", port, agg_nsh);
+    print_table_header();
+
+    static struct pollfd pf[AGG_CONN + 3 + HTTP_CLIENTS];
+    static unsigned char b[65536];
+
+    while (!atomic_load(&agg_stop))
+    {
+        int np = agg_nc, nh = 0;
+        pf[0].fd = tcp;  pf[1].fd = udp;
+        for(int i=0; i<np; i++) pf[2+i].fd = agg_c[i].fd;
+        if (http_fd >= 0)  // wake up for HTTP requests too
+        {
+            pf[2+np+nh++].fd = http_fd;
+            for(int k=0; k<HTTP_CLIENTS; k++) if (hcl[k].fd) pf[2+np+nh++].fd = hcl[k].fd;
+        }
+        for(int i=0; i<np+2+nh; i++) { pf[i].events = POLLIN;  pf[i].revents = 0; }
+        poll(pf, np+2+nh, 20);
+        double now = wall_time();
+
+        if (pf[0].revents & POLLIN)
+            for(int fd; (fd = accept(tcp, NULL, NULL)) >= 0; )
+            {
+                if (agg_nc == AGG_CONN) { close(fd);  continue; }
+                memset(&agg_c[agg_nc], 0, sizeof(agg_conn));  agg_c[agg_nc++].fd = fd;
+            }
+
+        if (pf[1].revents & POLLIN)
+            while ((n = recv(udp, b, sizeof(b), 0)) > 0) { agg_input(&agg_udp, b, n, now);  agg_input(&agg_udp, (unsigned char *)"\n", 1, now); }  // whole lines per datagram
+
+        for(int i=np-1; i>=0; i--)  // removal moves the last connection here, those above are done
+            if (pf[2+i].revents)
+            {
+                agg_conn *c = &agg_c[i];
+                if ((n = recv(c->fd, b, sizeof(b), 0)) > 0 && agg_input(c, b, n, now) == 0) continue;
+                close(c->fd);
+                if (c->d) { free(c->d->s);  free(c->d); }
+                *c = agg_c[--agg_nc];
+            }
+
+        agg_drain();
+        agg_release(now);
+        clk_t0 = now;  clk_smp = 0;  // timers and ticks run on the wall clock here
+        output_tick();
+        fflush(stdout);
+    }
+
+    for(int k=0; k<agg_nsh; k++) { pthread_join(agg_sh[k].th, NULL);  agg_dups += agg_sh[k].dups;  agg_bad += agg_sh[k].bad; }
+    agg_drain();
+    agg_release(1e300);
+    output_tick();
+    return 0;
+}
+
+#else
+    int aggregate(char *arg) { return -1; }
+#endif
+
+// =========================================== IQ recordings ==========================================
+//
+// -w file.iq stores the raw stream from rtl_tcp together with a sidecar index file.iq.idx holding one
+// idx_entry per second of signal.  -r file.iq decodes a recording, -S from,to seeks through the index
+// and decodes just that slice (seconds from the start of the recording, or UTC seconds).
+
+typedef struct { double t;  long long off;  int bursts, reserved; } idx_entry;  // time of the sample at byte offset off, bursts in the second
+
+FILE *rec_f, *rec_idx;
+long long rec_off, rec_gate;
+idx_entry rec_e;
+
+int rec_open(char *file)
+{
+    char idx[1024];  snprintf(idx, sizeof(idx), "%s.idx", file);
+    rec_f = fopen(file, "wb");  rec_idx = fopen(idx, "wb");
+    return !rec_f || !rec_idx;
+}
+
+void rec_flush(void)  // index entry of the finished second
+{
+    if (rec_e.t == 0) return;
+    rec_e.bursts = stat_gate - rec_gate;  rec_gate = stat_gate;
+    fwrite(&rec_e, sizeof(rec_e), 1, rec_idx);  fflush(rec_idx);
+}
+
+void rec_write(unsigned char *buff, int n)  // after proces_buff(n/2, buff)
+{
+    if (!rec_f) return;
+
+    double t = clk_t0 + (double)(clk_smp - n/2)/RATE;  // first sample of buff
+    if (rec_e.t == 0 || t >= rec_e.t + 1.0)
+    {
+        rec_flush();
+        rec_e.t = t;  rec_e.off = rec_off;
+    }
+    fwrite(buff, 1, n, rec_f);  rec_off += n;
+}
+
+void rec_close(void) { if (rec_f) { rec_flush();  fclose(rec_f);  fclose(rec_idx); } }
+
+void idx_find(FILE *x, double t, idx_entry *e)  // last entry at or before t (or the first one)
+{
+    fseek(x, 0, SEEK_END);
+    long lo = 0, hi = ftell(x)/sizeof(*e) - 1;
+    while (lo < hi)
+    {
+        long mid = (lo+hi+1)/2;
+        fseek(x, mid*sizeof(*e), SEEK_SET);
+        if (fread(e, sizeof(*e), 1, x) != 1 || e->t > t) hi = mid-1;  else lo = mid;
+    }
+    fseek(x, lo*sizeof(*e), SEEK_SET);
+    if (fread(e, sizeof(*e), 1, x) != 1) memset(e, 0, sizeof(*e));
+}
+
+char *div_src;  // -Y : second antenna, a recording made alongside the one of -r or the port of its rtl_tcp
+
+// Two dongles start streaming at moments far further apart than div_align follows.  Before decoding, the power
+// envelopes of a second of both antennas are cross-correlated, the leading stream drops the difference and
+// div_align takes the rest from the bursts.  A second without bursts tells nothing, the next one is tried.
+
+#define DIV_EB    150       // IQ samples per envelope bin, 0.5 ms
+#define DIV_WIDE  (RATE/4)  // [IQ samples] largest offset found
+#define DIV_TRIES 10        // seconds tried
+#define DIV_ACQ   0.3       // least normalised correlation of the envelopes
+
+int div_skip;  // IQ samples the second stream was ahead at the start
+
+int div_acquire(unsigned char *b1, unsigned char *b2, int n, int *skip)  // n IQ samples of both antennas; 0 = no bursts to go by, else skip[] IQ samples of each
+{
+    static double e[2][NIQ/DIV_EB];
+    int m = n/DIV_EB < NIQ/DIV_EB ? n/DIV_EB : NIQ/DIV_EB, w = DIV_WIDE/DIV_EB, best = 0;
+    double en[2] = {0}, cmax = 0;
+    if (m < 4*w) return 0;
+
+    for(int a=0; a<2; a++)  // zero mean envelopes
+    {
+        unsigned char *b = a ? b2 : b1;
+        double mean = 0;
+        for(int q=0; q<m; q++) { double p = 0;  for(int j=2*q*DIV_EB; j<2*(q+1)*DIV_EB; j++) p += (b[j]-127.5)*(b[j]-127.5);  e[a][q] = p;  mean += p; }
+        mean /= m;
+        for(int q=0; q<m; q++) { e[a][q] -= mean;  en[a] += e[a][q]*e[a][q]; }
+    }
+    for(int L=-w; L<=w; L++)  // a burst at bin q of antenna 1 is at q+L of antenna 2
+    {
+        double c = 0;
+        for(int q = L < 0 ? -L : 0; q < m && q+L < m; q++) c += e[0][q]*e[1][q+L];
+        if (c > cmax) { cmax = c;  best = L; }
+    }
+    if (cmax < DIV_ACQ * sqrt(en[0]*en[1])) return 0;
+
+    div_skip = best*DIV_EB;
+    skip[0] = best < 0 ? -div_skip : 0;  skip[1] = best > 0 ? div_skip : 0;
+    return 1;
+}
+
+int file_recv(char *file, double from, double to)  // to = 0 : until the end
+{
+    static unsigned char buff[2*NIQ], buff2[2*NIQ];
+    char idx[1024];  snprintf(idx, sizeof(idx), "%s.idx", file);
+    idx_entry e = {0};
+
+    FILE *f = fopen(file, "rb"), *x = fopen(idx, "rb"), *f2 = NULL;
+    if (!f) return 1;
+    if (div_src && !(f2 = fopen(div_src, "rb"))) { fclose(f);  return 4; }
+    if (x)
+    {
+        if (fread(&e, sizeof(e), 1, x) == 1 && from < 1e9) { if (to) to += e.t;  from += e.t; }  // relative to the start
+        idx_find(x, from, &e);
+        fclose(x);
+        if (fseek64(f, e.off, SEEK_SET) || (f2 && fseek64(f2, e.off, SEEK_SET))) { fclose(f);  if (f2) fclose(f2);  return 3; }  // recorded together, same offsets
+        clk_t0 = e.t;  clk_smp = 0;
+    }
+    else if (from || to) { fclose(f);  if (f2) fclose(f2);  return 2; }  // no index, cannot seek
+
+    if (f2)  // offset of the antennas, then back to the start less what the leading one drops
+    {
+        int skip[2] = {0};
+        for(int k=0; k<DIV_TRIES; k++)
+        {
+            int n1 = fread(buff, 1, 2*NIQ, f), n2 = fread(buff2, 1, 2*NIQ, f2);
+            if (div_acquire(buff, buff2, (n1 < n2 ? n1 : n2)/2, skip) || n1 < 2*NIQ || n2 < 2*NIQ) break;
+        }
+        if (fseek64(f, e.off + 2LL*skip[0], SEEK_SET) || fseek64(f2, e.off + 2LL*skip[1], SEEK_SET)) { fclose(f);  fclose(f2);  return 3; }
+        clk_smp = skip[0];
+    }
+
+    print_table_header();
+    int n;
+    double t = trace_now();
+    while (!trace_stop && (n = fread(buff, 1, 2*NIQ, f)) > 1 && !(to && clk_t0 + (double)clk_smp/RATE >= to))
+    {
+        if (f2 && (n = fread(buff2, 1, n, f2)) < 2) break;
+        div_iq = f2 ? buff2 : NULL;
+        trace_mark("file read", t);  proces_buff(n/2, buff);  t = trace_now();
+    }
+    fclose(f);
+    if (f2) fclose(f2);
+    return 0;
+}
+
+// =========================================== IQ data from socket ==========================================
+
+#if defined(__linux__) || defined(__APPLE__)
+    int tcp_connect(char *host, char *port)  // socket, -2 not resolved, -3 no socket
+    {
+        int sock = -1;
+        struct addrinfo *result = NULL, *ptr = NULL, hints;
+
+        memset (&hints, 0, sizeof (hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        if (getaddrinfo(host, port, &hints, &result) != 0) { return -2; }
+
+        for(ptr=result; ptr != NULL; ptr=ptr->ai_next)  // Attempt to connect to an address until one succeeds
+        {
+            if ((sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol)) < 0)
+            {
+                printf("Socket creation error\n");
+                return -3;
+            }
+            if (connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen) < 0)
+            {
+                close(sock);  sock = -5;
+                printf("Connection Failed\nDid you run\n$ rtl_tcp -f 162e6 -s 300000 -a 127.0.0.1 -p %s -g 48.0\n", port);
+                continue;
+            }
+            break;
+        }
+        return sock;
+    }
+
+    int tcp_recv(char *host, char *port)
+    {
+        int sock = tcp_connect(host, port), sock2 = -1;
+        if (sock < 0) return -sock;
+        if (div_src && (sock2 = tcp_connect(host, div_src)) < 0) { close(sock);  return 4; }
+
+        int n;
+        static unsigned char buff[2*NIQ], buff2[2*NIQ];
+        if ((n=recv(sock, buff, 12, MSG_WAITALL)) > 0) fprintf(info_out(), "\n === (%d bytes) %.4s === \n\n", n, buff);  // header: magic, tuner type, gain count
+        if (sock2 >= 0 && recv(sock2, buff2, 12, MSG_WAITALL) != 12) { close(sock);  close(sock2);  return 4; }  // its header
+
+        int skip[2] = {0};
+        for(int k=0; sock2 >= 0 && k<DIV_TRIES; k++)  // the first seconds go to the offset of the antennas
+        {
+            if (recv(sock, buff, 2*NIQ, MSG_WAITALL) != 2*NIQ || recv(sock2, buff2, 2*NIQ, MSG_WAITALL) != 2*NIQ) { close(sock);  close(sock2);  return 4; }
+            if (div_acquire(buff, buff2, NIQ, skip)) break;
+        }
+        for(int a=0; a<2; a++)  // the leading stream drops it
+            for(int k=2*skip[a]; k > 0; ) { int r = recv(a ? sock2 : sock, buff, k < 2*NIQ ? k : 2*NIQ, 0);  if (r <= 0) break;  k -= r; }
+        print_table_header();
+        double t = trace_now();
+        int r = 0;  // odd byte carried to the next read
+        while(!trace_stop && (n=read(sock, buff+r, 2*NIQ-r)) > 0)
+        {
+            trace_mark("tcp_recv", t);
+            n += r;
+            if (sock2 >= 0) { if (recv(sock2, buff2, n & ~1, MSG_WAITALL) != (n & ~1)) break;  div_iq = buff2; }  // same samples of the other antenna
+            proces_buff(n/2, buff);  rec_write(buff, n & ~1);
+            if ((r = n&1)) buff[0] = buff[n-1];
+            t = trace_now();
+        }
+        rec_close();
+
+        close(sock);
+        if (sock2 >= 0) close(sock2);
+        return trace_stop ? 0 : n;
+    }
+#elif defined(_WIN32)
+    int tcp_recv(char *host, char *port)
+    {
+        WSADATA wsaData;
+        SOCKET sock = INVALID_SOCKET;
+        struct addrinfo *result = NULL, *ptr = NULL, hints;
+
+        if (WSAStartup(MAKEWORD(2,2), &wsaData)) return 1;
+
+        ZeroMemory(&hints, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        if (getaddrinfo(host, port, &hints, &result) != 0) { WSACleanup();  return 2; }
+
+        for(ptr=result; ptr != NULL; ptr=ptr->ai_next)  // Attempt to connect to an address until one succeeds
+        { sock = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);  if (sock == INVALID_SOCKET) { WSACleanup();  return 3; }
+            if (connect(sock, ptr->ai_addr, (int)ptr->ai_addrlen) == SOCKET_ERROR) { closesocket(sock); sock=INVALID_SOCKET; continue; }
+            break; }
+
+        freeaddrinfo(result);   if (sock == INVALID_SOCKET) { WSACleanup();  return 4; }
+
+        int n;
+        static unsigned char buff[2*NIQ];
+        if ((n=recv(sock, buff, 2*NIQ, 0)) > 0) fprintf(info_out(), "\n === (%d bytes) %s === \n\n", n, buff);  // initial packet
+        print_table_header();
+        double t = trace_now();
+        while(!trace_stop && (n=recv(sock, buff, 2*NIQ, MSG_WAITALL)) > 0) { trace_mark("tcp_recv", t);  proces_buff(n/2, buff);  rec_write(buff, n & ~1);  t = trace_now(); }
+        rec_close();
+
+        closesocket(sock);
+        WSACleanup();
+        return trace_stop ? 0 : n;
+    }
+#endif
+
+
+// =========================================== Benchmark ==========================================
+//
+// The buffers of the benches are allocated by bench(): other runs do not carry them.
+
+typedef struct
+{
+    unsigned char iq[10][2][2*NIQ];   // IQ blocks, two antennas
+    unsigned char quiet[2*NIQ];
+    double I[2][NIQ], Q[2][NIQ];      // signal before quantising
+    double eI[20000], eQ[20000];      // echo of a burst
+    int idx[VT_MAX];
+    timer tm[500000];
+} bench_mem;
+
+bench_mem *bw;
+
+void bench_payloads(unsigned char p[3][56])  // typical messages 1, 4 and 5
+{
+    memset(p, 0, 3*56);
+    int2bits(p[0], 0, 6, 1);  int2bits(p[0], 8, 30, 211234560);  int2bits(p[0], 42, 8, -12);  int2bits(p[0], 50, 10, 123);
+    int2bits(p[0], 61, 28, -1234567);  int2bits(p[0], 89, 27, 32412345);  int2bits(p[0], 116, 12, 2345);  int2bits(p[0], 128, 9, 233);
+
+    int2bits(p[1], 0, 6, 4);  int2bits(p[1], 8, 30, 2190047);  int2bits(p[1], 38, 14, 2022);  int2bits(p[1], 52, 4, 6);  int2bits(p[1], 56, 5, 14);
+    int2bits(p[1], 61, 5, 12);  int2bits(p[1], 66, 6, 30);  int2bits(p[1], 79, 28, 7512345);  int2bits(p[1], 107, 27, 33067890);
+
+    int2bits(p[2], 0, 6, 5);  int2bits(p[2], 8, 30, 211234560);  int2bits(p[2], 40, 30, 9123456);  chars2bits(p[2], 70, 42, "DABC");
+    chars2bits(p[2], 112, 120, "NORDIC \"BLUE\" STAR");  int2bits(p[2], 232, 8, 70);  int2bits(p[2], 240, 9, 120);  int2bits(p[2], 249, 9, 30);
+    int2bits(p[2], 274, 4, 6);  int2bits(p[2], 278, 5, 15);  int2bits(p[2], 294, 8, 85);  chars2bits(p[2], 302, 120, "HAMBURG");
+}
+
+long long bench_emitted;
+void bench_emit(AIS_msg *m) { bench_emitted++; }
+
+void bench_uplink(void)  // 2000 vessels under way for 10 minutes: position every 2 s, message 5 every 6 min
+{
+    static unsigned char p[3][56], q[56];
+    AIS_msg m;
+    long long sent = up_msgs;
+    bench_payloads(p);
+    up_f = tmpfile();  if (!up_f) return;
+
+    double t = wall_time();
+    for(int s=0; s<600; s+=2)
+    {
+        for(int k=0; k<2000; k++)
+        {
+            parse_AIS_message(p[0], &m);
+            m.mmsi += k;  m.lon += k*997 + s*12;  m.lat += k*661 + s*7;  m.sog += (s/30 + k) % 3;  m.cog = (k*37 + s/10) % 3600;  m.sec = s % 60;
+            m.t = 1655209800.0 + s + k*0.001;  m.ch = 1 + (k&1);
+            if (k % 180 == s % 180) { parse_AIS_message(p[2], &m);  m.mmsi += k;  m.t = 1655209800.0 + s + k*0.001; }
+            m.len = build_AIS_message(&m, q);  m.p = q;
+            uplink_AIS_message(&m, vessel_update(&m));
+        }
+        uplink_flush();
+    }
+    t = wall_time() - t;
+    sent = up_msgs - sent;
+
+    static up_dec d;  static unsigned char b[65536];
+    int n;
+    d.emit = bench_emit;
+    rewind(up_f);
+    double t2 = wall_time();
+    while ((n = fread(b, 1, sizeof(b), up_f)) > 0) uplink_feed(&d, b, n);
+    t2 = wall_time() - t2;
+    fclose(up_f);  up_f = NULL;
+
+    printf(" uplink           %10.0f msg/s   %5.1f B/msg  (NMEA %.1f B/msg), decoded %lld of %lld at %.0f msg/s%s\n",
+           up_msgs/t, (double)up_bytes/up_msgs, (double)up_nmea/up_msgs, bench_emitted, sent, bench_emitted/t2, bench_emitted == sent ? "" : "  MISMATCH");
+}
+
+#if defined(__linux__) || defined(__APPLE__)
+
+atomic_int bench_run;
+typedef struct { pthread_t th;  unsigned seed;  long long reads, found, torn; } bench_reader;
+
+void *bench_read(void *a)  // random lookups, lat = -lon in every consistent copy
+{
+    bench_reader *r = a;
+    vessel_snap s;
+    unsigned x = r->seed;
+    while (atomic_load_explicit(&bench_run, memory_order_relaxed))
+    {
+        x = x*1103515245 + 12345;
+        if (vessel_read(300000000 + (x>>8) % 20000, &s)) { r->found++;  r->torn += s.lat != -s.lon; }
+        r->reads++;
+    }
+    return NULL;
+}
+
+void bench_vessels(void)  // one writer updating 10000 vessels, 0..4 reader threads
+{
+    static unsigned char p[3][56];
+    AIS_msg m;
+    bench_payloads(p);
+
+    for(int nr=0; nr<=4; nr = nr ? 2*nr : 1)
+    {
+        bench_reader r[4];
+        long long nw = 0, nrd = 0, nf = 0, torn = 0;
+        atomic_store(&bench_run, 1);
+        for(int k=0; k<nr; k++) { memset(&r[k], 0, sizeof(r[k]));  r[k].seed = k+1;  pthread_create(&r[k].th, NULL, bench_read, &r[k]); }
+
+        double t0 = wall_time(), t;
+        do for(int k=0; k<1000; k++, nw++)
+        {
+            parse_AIS_message(p[0], &m);
+            m.mmsi = 300000000 + nw % 10000;  m.lon = nw % 1000000;  m.lat = -m.lon;  m.t = 1655209800.0 + nw*1e-4;
+            vessel_update(&m);
+        }
+        while ((t = wall_time() - t0) < 0.3);
+
+        atomic_store(&bench_run, 0);
+        for(int k=0; k<nr; k++) { pthread_join(r[k].th, NULL);  nrd += r[k].reads;  nf += r[k].found;  torn += r[k].torn; }
+        printf(" vessel table     %10.0f upd/s   %d readers %10.0f reads/s  (%lld found, %lld torn)\n", nw/t, nr, nrd/t, nf, torn);
+    }
+}
+
+void bench_geojson(void)  // picture of the table after 100 of its vessels moved: tiles re-encoded against all
+{
+    static unsigned char p[3][56];
+    AIS_msg m;
+    bench_payloads(p);
+
+    double t = wall_time();
+    http_entry *e = http_lookup("/geojson");  if (!e) return;
+    double tf = wall_time() - t, tr = 0, ta = 0;
+    int len = e->b->len, N = 100;
+
+    for(int r=0; r<2*N; r++)
+    {
+        for(int k=0; k<100; k++)
+        {
+            vessel *v = &vt[(r*7919 + k*104729) % vt_n];
+            parse_AIS_message(p[0], &m);
+            m.mmsi = v->mmsi;  m.lon = v->lon + 100;  m.lat = v->lat;  m.t = v->t + 2;
+            vessel_update(&m);
+        }
+        if (r >= N) geo_all = 1;
+        t = wall_time();
+        e = http_lookup("/geojson");  if (!e) return;
+        if (r < N) tr += wall_time() - t;  else ta += wall_time() - t;
+    }
+    printf(" GeoJSON of %d    %5.1f ms, %.1f MB   after 100 moved %5.2f ms   all tiles again %5.1f ms\n",
+           vt_n, tf*1e3, len/1e6, tr/N*1e3, ta/N*1e3);
+}
+
+#else
+    void bench_vessels(void) {}
+    void bench_geojson(void) {}
+#endif
+
+int bench_fired;
+void bench_expire(timer *t) { bench_fired++; }
+
+void bench_tracks(void)  // 1000 vessels for an hour, report every 2 s, a turn every 10 min, 2 m position noise
+{
+    double tol = tk_tol, emax = 0, cl = cos(54 * M_PI/180), t0 = wall_time();  // flat around 54 N, 10 E
+    long long kept = tk_kept, skipped = tk_skipped;
+    unsigned x = 1;
+    tk_tol = 10;
+
+    for(int n=0; n<1000; n++)
+    {
+        track k;  memset(&k, 0, sizeof(k));
+        double east = 0, north = 0, sp = (5 + n%16) * (1852/3600.0), hd = n*37 % 360, rt = 0;  // m, m/s, deg, deg/s
+        double rt0 = 0, rsp = 0, rhd = 0;  int rlon = 0, rlat = 0;  // last kept report
+
+        for(int s=0; s<3600; s+=2)
+        {
+            if (s % 600 == 0) rt = (int)((x = x*1103515245 + 12345) >> 16) % 7 - 3;
+            if (s % 600 == 60) rt = 0;
+            hd += 2*rt;  east += 2*sp * sin(hd * M_PI/180);  north += 2*sp * cos(hd * M_PI/180);
+
+            double ne = east + ((int)((x = x*1103515245 + 12345) >> 16) % 401 - 200) * 0.01, nn = north + ((int)((x = x*1103515245 + 12345) >> 16) % 401 - 200) * 0.01;
+            int lon = (int)lround(6000000 + ne / (0.1852*cl)), lat = (int)lround(32400000 + nn / 0.1852);
+            int sog = (int)lround(sp * (36000/1852.0)), cog = (int)lround(fmod(hd + 36000, 360) * 10) % 3600;
+            double t = 1655209800.0 + s;
+
+            if (track_keep(&k, t, lon, lat, sog, cog)) { rt0 = t;  rlon = lon;  rlat = lat;  rsp = sog * (1852/36000.0);  rhd = cog * (M_PI/1800); }
+            else emax = fmax(emax, hypot((lon - rlon) * 0.1852 * cos(lat * (M_PI/180/600000)) - rsp*sin(rhd)*(t - rt0),
+                                         (lat - rlat) * 0.1852 - rsp*cos(rhd)*(t - rt0)));  // rebuilt from the kept one
+        }
+    }
+    kept = tk_kept - kept;  skipped = tk_skipped - skipped;
+    printf(" track -K 10      %10.0f rep/s   kept %.1f%% of %lld reports, largest deviation %.1f m\n",
+           (kept + skipped) / (wall_time() - t0), 100.0*kept/(kept + skipped), kept + skipped, emax);
+    tk_tol = tol;  tk_kept = tk_skipped = 0;
+}
+
+void bench_scans(void)  // table filled to 100000 vessels, SoA scans against the same test over vt
+{
+    static unsigned char p[3][56];
+    int *idx = bw->idx;
+    AIS_msg m;
+    bench_payloads(p);
+
+    for(int k=0; vt_n < 100000; k++)
+    {
+        parse_AIS_message(p[0], &m);
+        m.mmsi = 400000000 + k;  m.lon = (k*7919 % 21600 - 10800) * 10000;  m.lat = (k*104729 % 10800 - 5400) * 10000;
+        m.sog = k % 300;  m.t = 1655209800.0 + (k % 3600);
+        vessel_update(&m);
+    }
+
+    int N = 1000, nb = 0, ns = 0, no = 0, na = 0;
+    int lon0 = -600000, lon1 = 1800000, lat0 = 30000000, lat1 = 36000000;  // 1..3 E, 50..60 N
+    double t = wall_time();
+    for(int k=0; k<N; k++) nb = vs_bbox(lon0, lat0, lon1, lat1, idx);
+    double tb = wall_time() - t;  t = wall_time();
+    for(int k=0; k<N; k++) ns = vs_speed(200, 1023, idx);
+    double ts = wall_time() - t;  t = wall_time();
+    for(int k=0; k<N; k++) no = vs_stale(1655209800.0 + 1800, idx);
+    double to = wall_time() - t;  t = wall_time();
+    for(int k=0; k<N; k++)
+    {
+        na = 0;
+        for(int i=0; i<vt_n; i++) if (vt[i].known & VF_POS && vt[i].lon >= lon0 && vt[i].lon <= lon1 && vt[i].lat >= lat0 && vt[i].lat <= lat1) idx[na++] = i;
+    }
+    double ta = wall_time() - t;
+
+    printf(" scans of %d      bbox %5.1f us (%d)   speed %5.1f us (%d)   stale %5.1f us (%d)   bbox over vt %5.1f us (%d)\n",
+           vt_n, tb/N*1e6, nb, ts/N*1e6, ns, to/N*1e6, no, ta/N*1e6, na);
+}
+
+void bench_dsp(void)  // receiver chain over 10 s of noise at RATE, output of the block is dropped
+{
+    unsigned char *buff = bw->iq[0][0];
+    unsigned x = 1;
+    for(int k=0; k<2*NIQ; k++) buff[k] = 128 + (int)((x = x*1103515245 + 12345) >> 16) % 9 - 4;
+
+    long long ok = stat_ok;
+    double t = wall_time();
+    for(int k=0; k<10; k++) proces_buff(NIQ, buff);
+    t = wall_time() - t;
+    printf(" receiver chain   %10.1f MS/s    %.1f ms per %d samples (%.0fx real time)\n", 10*NIQ/t/1e6, t/10*1e3, NIQ, 10.0*NIQ/RATE/t);
+    stat_ok = ok;
+}
+
+int bench_frame(unsigned char *p, int len, signed char *sym)  // symbols as sent: preamble, flag, stuffed data and FCS, flag, NRZI
+{
+    unsigned char b[64];  memcpy(b, p, len);
+    unsigned short crc = crc16(p, len);  b[len] = crc & 0xff;  b[len+1] = crc >> 8;
+    char bits[1024];  int n = 0, ones = 0, lvl = 1;
+
+    for(int k=0; k<24; k++) bits[n++] = k & 1;
+    for(int k=0; k<8; k++) bits[n++] = 0x7E >> k & 1;
+    for(int i=0; i<len+2; i++) for(int k=0; k<8; k++)
+    { bits[n++] = b[i] >> k & 1;
+        if (!bits[n-1]) ones = 0;  else if (++ones == 5) { bits[n++] = 0;  ones = 0; } }
+    for(int k=0; k<8; k++) bits[n++] = 0x7E >> k & 1;
+
+    for(int k=0; k<n; k++) { if (!bits[k]) lvl = -lvl;  sym[k] = lvl; }  // change on 0
+    return n;
+}
+
+void bench_burst(double *I, double *Q, signed char *sym, int ns, double f, double df, double amp)  // GMSK BT 0.4 at RATE, f [Hz] carrier, df [Hz/s] drift
+{
+    static double g[5*64];  // frequency pulse over 5 symbols, 64 points per symbol
+    double sps = RATE/9600.0, ph = 0, w = sqrt(log(2)) / (2*M_PI*0.4) * sqrt(2);
+    if (g[2*64] == 0) for(int k=0; k<5*64; k++) g[k] = 0.5 * (erf((k/64.0 - 2) / w) - erf((k/64.0 - 3) / w));
+
+    for(int k=0; k<(ns+2)*sps; k++)
+    {
+        double t = k/sps, fr = 0;
+        for(int j=(int)t-2; j<=(int)t+2; j++) if (j >= 0 && j < ns) fr += sym[j] * g[(int)((t-j+2)*64)];
+        ph += 2*M_PI * (f + df*k/RATE + 2400*fr) / RATE;
+        double r = amp * fmin(1, k/(2*sps));  // ramp up
+        I[k] += r*cos(ph);  Q[k] += r*sin(ph);
+    }
+}
+
+int bench_ids[64];  char bench_seen[4096];
+void bench_count(AIS_msg *m) { bench_ids[m->id & 63]++;  bench_seen[m->mmsi & 4095] = 1; }
+
+void bench_reset(void)  // decoder and antennas as at start: no burst, filter or notch history crosses into the next row
+{
+    memset(ant, 0, sizeof(ant));  memset(dec_c, 0, sizeof(dec_c));
+    div_lag = div_aligned = 0;
+}
+
+void bench_flush(void)  // a quiet block closing a row: the decoder waits for samples behind its last burst
+{
+    if (div_iq) div_iq = bw->quiet;
+    proces_buff(NIQ, bw->quiet);
+}
+
+long long bench_st[4];  // counters of the run, kept out of the benches
+void bench_begin(void) { bench_st[0] = stat_gate;  bench_st[1] = stat_nosync;  bench_st[2] = stat_crc;  bench_st[3] = stat_ok;  dec_emit = bench_count;  bench_reset(); }
+void bench_end(void) { stat_gate = bench_st[0];  stat_nosync = bench_st[1];  stat_crc = bench_st[2];  stat_ok = bench_st[3];  dec_emit = output_AIS_message;  bench_reset(); }
+
+void bench_quantise(unsigned char *buff, double *I, double *Q, double noise)  // 8 bit IQ with Gaussian noise, Box-Muller
+{
+    static unsigned x = 1;
+    for(int k=0; k<NIQ; k++)
+    {
+        double u = ((x = x*1103515245 + 12345) >> 8 & 0xFFFFFF) / 16777216.0 + 1e-9, v = ((x = x*1103515245 + 12345) >> 8 & 0xFFFFFF) / 16777216.0;
+        double r = noise * sqrt(-2*log(u));
+        buff[2*k]   = fmax(0, fmin(255, lround(127.5 + I[k] + r*cos(2*M_PI*v))));
+        buff[2*k+1] = fmax(0, fmin(255, lround(127.5 + Q[k] + r*sin(2*M_PI*v))));
+    }
+}
+
+void bench_signal(unsigned char *buff, int nb, double f, double df, double noise, int sat)  // a buffer of nb bursts: messages 1 and 5, channels A and B in turn
+{                                                                                              // sat: carrier +-f, drift +-df, random times and levels
+    double *I = bw->I[0], *Q = bw->Q[0];
+    static unsigned char p[3][56];
+    static signed char sym[1024];
+    static unsigned x = 1;
+    bench_payloads(p);
+    memset(I, 0, NIQ*sizeof(double));  memset(Q, 0, NIQ*sizeof(double));
+
+    for(int k=0; k<nb; k++)
+    {
+        int at = 5000 + k*((NIQ-10000)/nb), ns = bench_frame(p[k&2], k&2 ? 53 : 21, sym);
+        double u = ((x = x*1103515245 + 12345) >> 8 & 0xFFFF) / 65536.0, v = ((x = x*1103515245 + 12345) >> 8 & 0xFFFF) / 65536.0;
+        if (sat) at = 5000 + (int)(((x = x*1103515245 + 12345) >> 8 & 0xFFFF) / 65536.0 * (NIQ-20000));
+        bench_burst(&I[at], &Q[at], sym, ns, ((k&1) ? 25000 : -25000) + (sat ? f*(2*u-1) : f), sat ? df*(2*v-1) : df, sat ? 20 + 60*v : 60);
+    }
+    bench_quantise(buff, I, Q, noise);
+}
+
+void bench_carrier(void)  // long and short frames with a carrier offset, slicing threshold fixed and tracked
+{
+    unsigned char *buff = bw->iq[0][0];
+    int track = dec_track;
+    bench_begin();
+
+    printf(" carrier offset   msg 1 fixed / tracked   msg 5 fixed / tracked   (noise 12, amplitude 60)\n");
+    for(int f=0; f<=2000; f+=500)
+    {
+        int r[2][2];
+        for(dec_track=0; dec_track<2; dec_track++)
+        {
+            bench_reset();  memset(bench_ids, 0, sizeof(bench_ids));
+            for(int k=0; k<5; k++) { bench_signal(buff, 20, f, 0, 12, 0);  proces_buff(NIQ, buff); }
+            bench_flush();
+            r[dec_track][0] = bench_ids[1];  r[dec_track][1] = bench_ids[5];
+        }
+        printf("  %5d Hz          %3d%% / %3d%%             %3d%% / %3d%%\n", f, 2*r[0][0], 2*r[1][0], 2*r[0][1], 2*r[1][1]);  // 50 of each
+    }
+    dec_track = track;
+    bench_end();
+}
+
+void bench_satellite(void)  // Doppler up to 4 kHz drifting 60 Hz/s, random times and levels, receiver and -L 4000 mode
+{
+    unsigned char *buff = bw->iq[0][0];
+    int sat = sat_doppler;
+    bench_begin();
+
+    printf(" satellite        bursts/s   msg 1 receiver / -L 4000   msg 5 receiver / -L 4000\n");
+    for(int nb=10; nb<=40; nb+=15)
+    {
+        int r[2][2];
+        for(int m=0; m<2; m++)
+        {
+            sat_doppler = m ? 4000 : 0;
+            bench_reset();  memset(bench_ids, 0, sizeof(bench_ids));
+            for(int k=0; k<10; k++) { bench_signal(buff, nb, 4000, 60, 8, 1);  proces_buff(NIQ, buff); }
+            bench_flush();
+            r[m][0] = bench_ids[1];  r[m][1] = bench_ids[5];
+        }
+        double n1 = 0, n5;
+        for(int k=0; k<nb; k++) n1 += 10 * !(k&2);  // k&2 picks message 5
+        n5 = 10*nb - n1;
+        printf("                     %2d          %3.0f%% / %3.0f%%                %3.0f%% / %3.0f%%\n", nb, 100*r[0][0]/n1, 100*r[1][0]/n1, 100*r[0][1]/n5, 100*r[1][1]/n5);
+    }
+    sat_doppler = sat;
+    bench_end();
+}
+
+void bench_multipath(void)  // a reflection at 70 % of the direct signal and a random phase, 1/4 to 1 symbol late
+{
+    unsigned char *buff = bw->iq[0][0];
+    double *I = bw->I[0], *Q = bw->Q[0], *eI = bw->eI, *eQ = bw->eQ;
+    static unsigned char p[3][56];
+    static signed char sym[1024];
+    int eq = dec_eq;
+    bench_payloads(p);
+    bench_begin();
+
+    printf(" multipath        echo   msg 1 plain / -E   msg 5 plain / -E   (70 %%, noise 4, amplitude 60)\n");
+    for(int q=1; q<=4; q++)
+    {
+        int r[2][2], dly = q * RATE/9600 / 4;
+        for(dec_eq=0; dec_eq<2; dec_eq++)
+        {
+            unsigned x = 3;  // same bursts for both
+            bench_reset();  memset(bench_ids, 0, sizeof(bench_ids));
+            for(int b=0; b<5; b++)
+            {
+                memset(I, 0, NIQ*sizeof(double));  memset(Q, 0, NIQ*sizeof(double));
+                for(int k=0; k<20; k++)
+                {
+                    int at = 5000 + k*((NIQ-10000)/20), ns = bench_frame(p[k&2], k&2 ? 53 : 21, sym), len = (ns+2)*RATE/9600 + 1;
+                    double f = (k&1) ? 25000 : -25000, ph = 2*M_PI * ((x = x*1103515245 + 12345) >> 8 & 0xFFFF) / 65536.0;
+                    bench_burst(&I[at], &Q[at], sym, ns, f, 0, 60);
+                    memset(eI, 0, len*sizeof(double));  memset(eQ, 0, len*sizeof(double));
+                    bench_burst(eI, eQ, sym, ns, f, 0, 42);
+                    for(int j=0; j<len; j++) { I[at+dly+j] += cos(ph)*eI[j] - sin(ph)*eQ[j];  Q[at+dly+j] += sin(ph)*eI[j] + cos(ph)*eQ[j]; }
+                }
+                bench_quantise(buff, I, Q, 4);
+                proces_buff(NIQ, buff);
+            }
+            bench_flush();
+            r[dec_eq][0] = bench_ids[1];  r[dec_eq][1] = bench_ids[5];
+        }
+        printf("                  %4.2f T      %3d%% / %3d%%        %3d%% / %3d%%\n", q/4.0, 2*r[0][0], 2*r[1][0], 2*r[0][1], 2*r[1][1]);  // 50 of each
+    }
+    dec_eq = eq;
+    bench_end();
+}
+
+void bench_interference(void)  // a carrier 1.5 kHz into channel A, 15 dB below the bursts, notch off and on
+{
+    unsigned char *buff = bw->iq[0][0];
+    double *I = bw->I[0], *Q = bw->Q[0];
+    static unsigned char p[3][56];
+    static signed char sym[1024];
+    int on = notch_on, notched = 0;
+    bench_payloads(p);
+    bench_begin();
+
+    printf(" interference     carrier   notch   gate fired   no sync   msg 1+5 decoded   (10 blocks of 20 bursts, noise 4)\n");
+    for(int c=0; c<2; c++) for(notch_on=0; notch_on<2; notch_on++)
+    {
+        long long g = stat_gate, f = stat_nosync;
+        bench_reset();  memset(bench_ids, 0, sizeof(bench_ids));
+        for(int b=0; b<10; b++)
+        {
+            memset(I, 0, NIQ*sizeof(double));  memset(Q, 0, NIQ*sizeof(double));
+            for(int k=0; k<20; k++)
+            { int at = 5000 + k*((NIQ-10000)/20), ns = bench_frame(p[k&2], k&2 ? 53 : 21, sym);
+                bench_burst(&I[at], &Q[at], sym, ns, (k&1) ? 25000 : -25000, 0, 60); }
+            for(int i=0; i<NIQ && c; i++) { double ph = 2*M_PI * (-25000 + 1500) * ((double)b*NIQ + i) / RATE;  I[i] += 10*cos(ph);  Q[i] += 10*sin(ph); }
+            bench_quantise(buff, I, Q, 4);
+            proces_buff(NIQ, buff);
+        }
+        bench_flush();
+        printf("                  %-7s   %-3s     %8lld   %7lld          %3d / 200\n", c ? "-23.5k" : "none", notch_on ? "on" : "off", stat_gate - g, stat_nosync - f, bench_ids[1] + bench_ids[5]);
+        notched += ant[0].nt[0].blocks + ant[0].nt[1].blocks;
+    }
+    printf("                  blocks notched %d\n", notched);
+    notch_on = on;
+    bench_end();
+}
+
+#if defined(__linux__) || defined(__APPLE__)
+void bench_spectrum(void)  // -F every block: the decode path with and without the copy, the spectra on the monitor, a carrier 1.5 kHz into channel A
+{
+    unsigned char *buff = bw->iq[0][0];
+    double *I = bw->I[0], *Q = bw->Q[0];
+    long long sets = spec_sets;
+    int every = spec_every;  FILE *f = spec_f;
+    double t[2], tm = 0;
+    if (spec_alloc()) return;
+    bench_begin();  spec_f = NULL;
+
+    for(int i=0; i<NIQ; i++) { double ph = 2*M_PI * (-25000 + 1500) * i / RATE;  I[i] = 10*cos(ph);  Q[i] = 10*sin(ph); }
+    bench_quantise(buff, I, Q, 4);
+    for(spec_every=0; spec_every<2; spec_every++)
+    {
+        t[spec_every] = 0;  bench_reset();
+        for(int k=0; k<10; k++)
+        {
+            double t0 = wall_time();
+            proces_buff(NIQ, buff);
+            t[spec_every] += wall_time() - t0;
+            if (spec_every) { t0 = wall_time();  spec_compute();  tm += wall_time() - t0;  atomic_store(&spec_full, 0); }
+        }
+    }
+    printf(" spectrum -F      ms per block %.2f / %.2f with the copy   ms per set of spectra %.2f on the monitor   carrier seen at %+.0f Hz in channel A, %.1f dB over the floor\n",
+           t[0]*100, t[1]*100, tm*100, spec_last[1].f, spec_last[1].peak - spec_last[1].floor);
+    spec_every = every;  spec_f = f;  spec_sets = sets;
+    bench_end();
+}
+#else
+    void bench_spectrum(void) {}
+#endif
+
+void bench_sync(void)  // 20 bursts a second in noise that holds the gate open, fine search alone and two-level
+{
+    int sat = sat_doppler, coarse = dec_coarse;
+    bench_begin();
+
+    printf(" sync search      ms per block fine / two-level   msg 1+5 fine / two-level\n");
+    for(int m=0; m<2; m++)
+    {
+        double t[2];  int r[2];
+        sat_doppler = m ? 4000 : 0;
+        for(int k=0; k<10; k++) bench_signal(bw->iq[k][0], 20, sat_doppler, m ? 60 : 0, 12, m);
+        for(dec_coarse=0; dec_coarse<2; dec_coarse++)
+        {
+            bench_reset();  memset(bench_ids, 0, sizeof(bench_ids));
+            t[dec_coarse] = wall_time();
+            for(int k=0; k<10; k++) proces_buff(NIQ, bw->iq[k][0]);
+            t[dec_coarse] = (wall_time() - t[dec_coarse]) / 10;
+            bench_flush();
+            r[dec_coarse] = bench_ids[1] + bench_ids[5];
+        }
+        printf("  %-14s      %5.1f / %5.1f                 %3d / %3d\n", m ? "-L 4000" : "receiver", 1e3*t[0], 1e3*t[1], r[0], r[1]);
+    }
+    sat_doppler = sat;  dec_coarse = coarse;
+    bench_end();
+}
+
+void bench_diversity(void)  // two antennas with independent Rayleigh fading and noise, the second 222 IQ samples late
+{
+    unsigned char (*b)[2][2*NIQ] = bw->iq;
+    double (*I)[NIQ] = bw->I, (*Q)[NIQ] = bw->Q;
+    static char seen[3][4096];
+    static unsigned char p[3][56];
+    static signed char sym[1024];
+    unsigned x = 7;
+    int n = 0, r[4] = {0}, only = 0;
+    bench_payloads(p);
+    bench_begin();
+
+    for(int blk=0; blk<10; blk++)
+    {
+        memset(bw->I, 0, sizeof(bw->I));  memset(bw->Q, 0, sizeof(bw->Q));
+        for(int k=0; k<20; k++, n++)  // a vessel each
+        {
+            int at = 5000 + k*((NIQ-10000)/20), len = k&2 ? 53 : 21;
+            int2bits(p[k&2], 8, 30, 200000000 + n);
+            int ns = bench_frame(p[k&2], len, sym);
+            for(int a=0; a<2; a++)
+            {
+                double u = ((x = x*1103515245 + 12345) >> 8 & 0xFFFF) / 65536.0 + 1e-6;
+                bench_burst(&I[a][at + 222*a], &Q[a][at + 222*a], sym, ns, (k&1) ? 25000 : -25000, 0, 10 * sqrt(-log(u)));
+            }
+        }
+        for(int a=0; a<2; a++) bench_quantise(b[blk][a], I[a], Q[a], 4);
+    }
+    for(int m=0; m<3; m++)  // first antenna, second antenna, both combined: each from the start
+    {
+        bench_reset();  memset(bench_seen, 0, sizeof(bench_seen));
+        for(int blk=0; blk<10; blk++) { div_iq = m == 2 ? b[blk][1] : NULL;  proces_buff(NIQ, b[blk][m == 1]); }
+        bench_flush();
+        memcpy(seen[m], bench_seen, sizeof(bench_seen));
+    }
+    div_iq = NULL;
+    for(int k=0; k<n; k++)
+    {
+        char *s = &seen[0][(200000000 + k) & 4095], a = s[0], b = s[4096], c = s[2*4096];
+        r[0] += a;  r[1] += b;  r[2] += a || b;  r[3] += c;  only += c && !a && !b;
+    }
+    printf(" diversity        antenna 1 / 2 / either / combined   %.0f%% / %.0f%% / %.0f%% / %.0f%%   %d frames neither antenna had, lag %d\n",
+           100.0*r[0]/n, 100.0*r[1]/n, 100.0*r[2]/n, 100.0*r[3]/n, only, div_lag);
+    bench_end();
+}
+
+void bench(void)  // -B : throughput of the decode path stages
+{
+    static unsigned char p[3][56];
+    static char buf[512];
+    int N = 3000000;
+    long long bytes = 0;
+    AIS_msg m;  memset(&m, 0, sizeof(m));
+
+    if (!(bw = calloc(1, sizeof(bench_mem)))) { printf("no memory for the benches\n");  return; }
+    memset(bw->quiet, 128, sizeof(bw->quiet));
+
+    bench_payloads(p);
+    bench_dsp();  // first, its clock is the wall time
+    bench_carrier();
+    bench_satellite();
+    bench_multipath();
+    bench_interference();
+    bench_sync();
+    bench_diversity();
+    bench_spectrum();
+
+    double t = wall_time();
+    for(int k=0; k<N; k++)
+    {
+        parse_AIS_message(p[k%3], &m);
+        m.t = 1655209800.0 + k*0.01;  m.ch = 1 + (k&1);  m.level = 3000 + k%1000;  m.corr = 500;
+        bytes += json_format(buf, &m) - buf;
+    }
+    t = wall_time() - t;
+    printf(" parse + JSON     %10.0f msg/s   %5.1f B/msg\n", N/t, (double)bytes/N);
+
+    int crc5 = crc16(p[2], 53);  // repeated static report
+    t = wall_time();
+    for(int k=0; k<N; k++) parse_AIS_message(p[2], &m);
+    t = wall_time() - t;
+    double t5 = wall_time();
+    for(int k=0; k<N; k++) parse_cached(p[2], 53, crc5, &m);
+    t5 = wall_time() - t5;
+    printf(" parse msg 5      %10.0f msg/s   cached %10.0f msg/s  (hit rate %.3f)\n", N/t, N/t5, (double)pc_hits/(pc_hits+pc_misses));
+
+    timer *tm = bw->tm;  // arm, re-arm half of them, expire all within an hour of sample clock
+    int NT = sizeof(bw->tm)/sizeof(bw->tm[0]);
+    if (tw_now < 0) timer_run(1000);
+    double t0 = (tw_now + 1)*TW_TICK;  // the wheel may already run on wall time
+    bench_fired = 0;
+    t = wall_time();
+    for(int k=0; k<NT; k++) timer_set(&tm[k], t0 + (k*7919LL % 36000)*0.1, bench_expire);
+    for(int k=0; k<NT; k+=2) timer_set(&tm[k], t0 + (k*104729LL % 36000)*0.1, bench_expire);
+    timer_run(t0 + 3600);
+    t = wall_time() - t;
+    printf(" timer wheel      %10.0f ops/s   (%d timers, %d expired)\n", (NT + NT/2 + NT)/t, NT, bench_fired);
+
+    bench_uplink();
+    bench_tracks();
+    bench_vessels();
+    bench_scans();
+    bench_geojson();
+    free(bw);  bw = NULL;
+}
+
+void print_stats(void)
+{
+    FILE *f = info_out();
+    fprintf(f, " bursts %lld: no sync %lld, CRC failed %lld, decoded %lld\n", stat_gate, stat_nosync, stat_crc, stat_ok);
+    if (up_msgs) fprintf(f, " uplink %lld msgs, %.1f B/msg (NMEA %.1f B/msg), %lld connections lost\n", up_msgs, (double)up_bytes/up_msgs, (double)up_nmea/up_msgs, up_lost);
+    if (agg_in) fprintf(f, " aggregated %lld frames: duplicates %lld, malformed %lld, out of order %lld\n", agg_in, agg_dups, agg_bad, agg_late);
+    if (div_src) fprintf(f, " second antenna %d IQ samples ahead at the start, then %d samples behind, measured on %d bursts\n", div_skip, div_lag, div_aligned);
+    if (spec_every) fprintf(f, " spectra %lld, %lld skipped by a busy monitor, floor %.1f dB input, %.1f / %.1f dB channels A / B\n",
+                            spec_sets, spec_skipped, spec_last[0].floor, spec_last[1].floor, spec_last[2].floor);
+    for(int k=0; k<2; k++) if (ant[0].nt[k].blocks) fprintf(f, " channel %c: narrowband interferer notched in %d blocks, last at %+.0f Hz\n", 'A'+k, ant[0].nt[k].blocks, ant[0].nt[k].f);
+    if (tk_tol > 0) fprintf(f, " track points kept %lld of %lld\n", tk_kept, tk_kept + tk_skipped);
+    if (th_interval >= 0) fprintf(f, " throttled %lld of %lld\n", th_dropped, th_dropped + th_passed);
+    if (http_fd >= 0) fprintf(f, " HTTP responses cached %lld / %lld\n", http_hits, http_hits + http_builds);
+    fprintf(f, " parse cache hits %lld / %lld, string pool hits %lld / %lld\n", pc_hits, pc_hits + pc_misses, sp_hits, sp_hits + sp_misses);
+    if (sp_full) fprintf(f, " string pool full, %lld texts dropped\n", sp_full);
+}
 
-int main()  // before start:  run rtl_tcp.exe -f 162e6 -s 300000 -a 127.0.0.1 -p 2345 -g 48.0
+int main(int argc, char *argv[])  // before start:  run rtl_tcp.exe -f 162e6 -s 300000 -a 127.0.0.1 -p 2345 -g 48.0
 {
-    int r = tcp_recv("127.0.0.1", "2345");
-    printf("\n status = %d \n", r);
+    char *replay = NULL, *iq_file = NULL, *capture = NULL, *agg = NULL;
+    double from = 0, to = 0;
+
+    for(int a=1; a<argc; a++)
+        if (!strcmp(argv[a], "-j")) out_json = 1;
+        else if (!strcmp(argv[a], "-n")) out_nmea = 1;
+        else if (!strcmp(argv[a], "-U") && a+1 < argc) { if (uplink_open(argv[++a])) { printf("cannot open uplink %s\n", argv[a]);  return 1; } }
+        else if (!strcmp(argv[a], "-X") && a+1 < argc) capture = argv[++a];
+        else if (!strcmp(argv[a], "-A") && a+1 < argc) agg = argv[++a];
+        else if (!strcmp(argv[a], "-W") && a+1 < argc) { if (ws_open(argv[++a])) { printf("WebSocket port %s not available\n", argv[a]);  return 1; } }
+        else if (!strcmp(argv[a], "-H") && a+1 < argc) { if (http_open(argv[++a])) { printf("HTTP port %s not available\n", argv[a]);  return 1; } }
+        else if (!strcmp(argv[a], "-T") && a+1 < argc) trace_open(argv[++a]);
+        else if (!strcmp(argv[a], "-D") && a+1 < argc) { if (!(dump_f = fopen(argv[++a], "wb"))) { printf("cannot write %s\n", argv[a]);  return 1; } }
+        else if (!strcmp(argv[a], "-R") && a+1 < argc) replay = argv[++a];
+        else if (!strcmp(argv[a], "-r") && a+1 < argc) iq_file = argv[++a];
+        else if (!strcmp(argv[a], "-w") && a+1 < argc) { if (rec_open(argv[++a])) { printf("cannot write %s\n", argv[a]);  return 1; } }
+        else if (!strcmp(argv[a], "-S") && a+1 < argc) sscanf(argv[++a], "%lf,%lf", &from, &to);
+        else if (!strcmp(argv[a], "-Q") && a+1 < argc)
+        { if (sscanf(argv[++a], "%lf,%lf", &th_dist, &th_interval) != 2 || th_dist < 0 || th_interval < 0) { printf("-Q wants metres,seconds, not %s\n", argv[a]);  return 1; } }
+        else if (!strcmp(argv[a], "-K") && a+1 < argc) sscanf(argv[++a], "%lf,%lf", &tk_tol, &tk_gap);
+        else if (!strcmp(argv[a], "-L") && a+1 < argc) sat_doppler = abs(atoi(argv[++a]));
+        else if (!strcmp(argv[a], "-Y") && a+1 < argc) div_src = argv[++a];
+        else if (!strcmp(argv[a], "-E")) dec_eq = 1;
+        else if (!strcmp(argv[a], "-P")) dec_track = 0;
+        else if (!strcmp(argv[a], "-N")) notch_on = 0;
+        else if (!strcmp(argv[a], "-C") && a+1 < argc) dec_coarse = atoi(argv[++a]) != 0;
+        else if (!strcmp(argv[a], "-F") && a+1 < argc) { if (spec_open(argv[++a])) { printf("cannot open spectrum output %s\n", argv[a]);  return 1; } }
+        else if (!strcmp(argv[a], "-B")) { bench();  return 0; }
+        else { printf("usage: %s [-j|-n] [-U host:port|file] [-X file] [-A port[,threads]] [-W port] [-H port] [-T trace.json] [-D dump] [-R dump] [-w file.iq] [-r file.iq [-S from,to]] [-Q m,s] [-K m[,s]] [-L Hz] [-Y src] [-E] [-P] [-N] [-C 0|1] [-F dst[,n]] [-B]\n"
+                      "  -j       JSON Lines output (one object per decoded frame)\n"
+                      "  -n       NMEA 0183 !AIVDM output\n"
+                      "  -U dst   compact binary uplink of the traffic to host:port or a file\n"
+                      "  -X file  decode a binary uplink stream instead of the receiver\n"
+                      "  -A port[,threads]  merge NMEA or -U feeds of stations on TCP/UDP port instead of the receiver\n"
+                      "  -W port  WebSocket live feed of vessel updates\n"
+                      "  -H port  HTTP queries of the vessels and their tracks\n"
+                      "  -T file  record pipeline stage timing, Chrome trace-event JSON written at exit\n"
+                      "  -D file  dump signal windows of frames failing sync or CRC\n"
+                      "  -R file  decode the windows dumped by -D instead of the receiver\n"
+                      "  -w file  record the IQ stream, with a time index in file.idx\n"
+                      "  -r file  decode a recording instead of the receiver\n"
+                      "  -S from,to  only the slice from..to, seconds from the start of the recording or UTC\n"
+                      "  -Q m,s   output a position only after moving m metres or s seconds, message 5 only when changed\n"
+                      "  -K m[,s] keep a position only when it is m metres off its dead-reckoned track or s seconds passed\n"
+                      "  -L Hz    satellite mode: wider channel filter, carrier search of +-Hz per burst, colliding bursts\n"
+                      "  -Y src   second antenna combined with the first: port of its rtl_tcp, or its recording made alongside -r\n"
+                      "  -E       equalize each burst, trained on its preamble (multipath near quays and hulls)\n"
+                      "  -P       keep the slicing threshold of the preamble through the burst instead of tracking it\n"
+                      "  -N       no notch for narrowband interferers in the channels\n"
+                      "  -C 0|1   two-level sync search off or on, by default on with -L only\n"
+                      "  -F dst[,n]  power spectra of the input and both channels every n seconds, binary frames to host:port or a file\n"
+                      "  -B       run benchmark\n", argv[0]);  return 1; }
+
+    if (replay) return dump_replay(replay);
+    if (capture) return uplink_replay(capture);
+
+    spec_wait = iq_file != NULL;
+    int r = agg ? aggregate(agg) : iq_file ? file_recv(iq_file, from, to) : tcp_recv("127.0.0.1", "2345");
+    spec_drain();
+    fprintf(info_out(), "\n status = %d \n", r);
+    print_stats();
     return 0;
 }